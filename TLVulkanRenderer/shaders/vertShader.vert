@@ -10,6 +10,12 @@ layout(binding = 0) uniform UniformBufferObject {
 	mat4 proj;
 } ubo;
 
+// Transform of the instance being drawn, identity for baked meshes
+layout(push_constant) uniform PushConstants {
+	mat4 instance;
+	mat4 instanceNormal;
+} push;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 
@@ -19,11 +25,11 @@ layout(location = 3) out vec3 fragPosition;
 
 
 void main() {
-	vec4 position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-	vec4 positionW = ubo.model * vec4(inPosition, 1.0);
+	vec4 position = ubo.proj * ubo.view * ubo.model * push.instance * vec4(inPosition, 1.0);
+	vec4 positionW = ubo.model * push.instance * vec4(inPosition, 1.0);
 	
 	// -- Out
-	fragNormal = inNormal;
+	fragNormal = normalize(mat3(push.instanceNormal) * inNormal);
 	fragPosition = vec3(positionW);
 	lightDirection = normalize(vec3(10.0, 20.0, 20.0) - vec3(positionW));
 
@@ -132,8 +132,13 @@ Application::Application(
 
 	std::map<std::string, std::string> config = {
 		{ "USE_SBVH", "true" },
+		{ "ACCEL_STRUCTURE", "QBVH" },
 		{ "VISUALIZE_SBVH", "false"},
-		{ "VISUALIZE_RAY_COST", "true"}
+		{ "VISUALIZE_RAY_COST", "false"},
+		{ "CPU_FRAME_BUDGET_MS", "33" },
+		{ "CPU_MAX_SAMPLES", "1024" },
+		{ "CPU_WAVEFRONT", "false" },
+		{ "SCENE_CACHE", "true" }
 	};
 	m_scene = new Scene(sceneFile, config);
 
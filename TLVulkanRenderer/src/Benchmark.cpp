@@ -0,0 +1,313 @@
+#include "Benchmark.h"
+#include "renderer/CPURaytracer.h"
+#include "accel/Instance.h"
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+namespace {
+
+	struct PrimaryHit {
+		Point3 position;
+		Normal normal;
+		bool isHit;
+	};
+
+	// Same distribution as the Lambert material: the normal plus a random point in the unit sphere
+	Direction DiffuseDirection(const Normal& normal, RNG& rng) {
+		Point3 p;
+		do {
+			p = 2.0f * Point3(rng.NextFloat(), rng.NextFloat(), rng.NextFloat()) - Point3(1, 1, 1);
+		} while (glm::dot(p, p) >= 1.0f);
+		return glm::normalize(normal + p);
+	}
+
+	double SecondsSince(const Clock::time_point& start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	std::string EscapeJSON(const std::string& text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	bool EndsWith(const std::string& text, const std::string& suffix) {
+		return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+}
+
+Benchmark::Benchmark(
+	const Settings& settings
+) : m_settings(settings), m_threadPool(settings.numThreads) {
+	if (m_settings.sceneFiles.empty()) {
+		m_settings.sceneFiles = GetDefaultScenes();
+	}
+}
+
+std::vector<std::string> Benchmark::GetDefaultScenes() {
+	return {
+		"scenes/gltfs/Duck/duck.gltf",
+		"scenes/gltfs/cow/cow.gltf",
+		"scenes/gltfs/truck/truck.gltf",
+		"scenes/gltfs/octocat/octocat.gltf",
+		"scenes/gltfs/wolf/wolf.gltf",
+		"scenes/gltfs/2_cylinder_engine/2_cylinder_engine.gltf",
+		"scenes/gltfs/helmet/Helmet.gltf",
+		"scenes/gltfs/sponza/sponza.gltf"
+	};
+}
+
+bool Benchmark::Run() {
+	m_results.clear();
+	for (const std::string& sceneFile : m_settings.sceneFiles) {
+		std::cout << "=== Benchmarking " << sceneFile << std::endl;
+		Result result = RunScene(sceneFile);
+		std::cout << std::fixed << std::setprecision(2)
+			<< "Build " << result.buildSeconds * 1000.0f << " ms, "
+			<< "primary " << result.primaryRaysPerSecond / 1e6 << " Mrays/s, "
+			<< "packets " << result.primaryPacketRaysPerSecond / 1e6 << " Mrays/s, "
+			<< "shadow " << result.shadowRaysPerSecond / 1e6 << " Mrays/s, "
+			<< "bounce " << result.bounceRaysPerSecond / 1e6 << " Mrays/s, "
+			<< "accel " << result.accelBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+		std::cout.unsetf(std::ios::floatfield);
+		m_results.push_back(result);
+	}
+
+	const std::string& fileName = m_settings.outputFile;
+	bool saved = EndsWith(fileName, ".csv") ? SaveCSV(fileName) : SaveJSON(fileName);
+	if (!saved) {
+		std::cout << "Failed to write " << fileName << std::endl;
+		return false;
+	}
+
+	std::cout << "Saved " << fileName << std::endl;
+	return true;
+}
+
+Benchmark::Result Benchmark::RunScene(
+	const std::string& sceneFile
+) {
+	Result result;
+	result.sceneFile = sceneFile;
+
+	std::map<std::string, std::string> config = {
+		{ "USE_SBVH", "true" },
+		{ "ACCEL_STRUCTURE", m_settings.accelStructure }
+	};
+
+	auto loadStart = Clock::now();
+	Scene scene(sceneFile, config);
+	result.loadSeconds = SecondsSince(loadStart);
+	result.buildSeconds = scene.accelBuildSeconds;
+	result.numGeometries = scene.geometries.size();
+	for (const Mesh& mesh : scene.meshes) {
+		result.numTriangles += mesh.triangles.size();
+	}
+	if (result.numTriangles == 0) {
+		std::cout << "Warning: no triangles loaded from " << sceneFile << ", only the built-in geometry is measured" << std::endl;
+	}
+	result.accelBytes = scene.GetAccelMemoryFootprint();
+
+	result.geometryBytes = scene.geometries.capacity() * sizeof(std::shared_ptr<Geometry>);
+	for (const Mesh& mesh : scene.meshes) {
+		result.geometryBytes += mesh.triangles.capacity() * sizeof(Triangle);
+	}
+	for (auto& bottomLevel : scene.bottomLevelAccels) {
+		result.geometryBytes += bottomLevel->geometries.capacity() * sizeof(std::shared_ptr<Geometry>);
+	}
+
+	// The scene's own camera is fixed, only the resolution changes
+	uint32_t width = m_settings.width;
+	uint32_t height = m_settings.height;
+	scene.camera.resolution = glm::ivec2(width, height);
+	scene.camera.aspect = float(width) / height;
+	scene.camera.RecomputeAttributes();
+
+	std::vector<PrimaryHit> hits(width * height);
+
+	// Rows are small enough to balance well and large enough to keep scheduling out of the timings
+	auto runRows = [&](const std::function<uint64_t(uint32_t y)>& traceRow) -> double
+	{
+		std::atomic<uint64_t> numRays{0};
+		auto start = Clock::now();
+		for (uint32_t iteration = 0; iteration < m_settings.iterations; iteration++) {
+			m_threadPool.ParallelFor(height, [&](uint32_t y, uint32_t threadId)
+			{
+				numRays += traceRow(y);
+			});
+		}
+		double seconds = SecondsSince(start);
+		return seconds > 0 ? numRays / seconds : 0;
+	};
+
+	// --- Primary rays
+	result.primaryRaysPerSecond = runRows([&](uint32_t y) -> uint64_t
+	{
+		for (uint32_t x = 0; x < width; x += RAY_PACKET_SIZE) {
+			uint32_t numRays = std::min(width - x, RAY_PACKET_SIZE);
+			Ray rays[RAY_PACKET_SIZE];
+			scene.camera.GenerateRayRow(x + 0.5f, y + 0.5f, numRays, rays);
+			for (uint32_t i = 0; i < numRays; i++) {
+				Intersection isx = scene.GetIntersection(rays[i]);
+				hits[x + i + y * width] = { isx.hitPoint, isx.hitNormal, isx.t > 0 };
+			}
+		}
+		return width;
+	});
+
+	result.primaryPacketRaysPerSecond = runRows([&](uint32_t y) -> uint64_t
+	{
+		for (uint32_t x = 0; x < width; x += RAY_PACKET_SIZE) {
+			uint32_t packetSize = std::min(width - x, RAY_PACKET_SIZE);
+			Ray packet[RAY_PACKET_SIZE];
+			Intersection isxs[RAY_PACKET_SIZE];
+			scene.camera.GenerateRayRow(x + 0.5f, y + 0.5f, packetSize, packet);
+			scene.GetIntersectionPacket(packet, packetSize, isxs);
+		}
+		return width;
+	});
+
+	size_t numHits = 0;
+	for (const PrimaryHit& hit : hits) {
+		numHits += hit.isHit;
+	}
+	result.primaryHitRatio = float(numHits) / hits.size();
+
+	// --- Shadow rays
+	result.shadowRaysPerSecond = runRows([&](uint32_t y) -> uint64_t
+	{
+		uint64_t numRays = 0;
+		for (uint32_t x = 0; x < width; x++) {
+			const PrimaryHit& hit = hits[x + y * width];
+			if (!hit.isHit) continue;
+
+			for (Light* light : scene.lights) {
+				Direction dir = glm::normalize(light->GetPosition() - hit.position);
+				Point3 origin = hit.position + EPSILON * dir;
+				Ray shadowFeeler(origin, dir);
+				scene.DoesIntersect(shadowFeeler, glm::distance(light->GetPosition(), origin));
+				numRays++;
+			}
+		}
+		return numRays;
+	});
+
+	// --- Diffuse bounce rays
+	result.bounceRaysPerSecond = runRows([&](uint32_t y) -> uint64_t
+	{
+		uint64_t numRays = 0;
+		for (uint32_t x = 0; x < width; x++) {
+			const PrimaryHit& hit = hits[x + y * width];
+			if (!hit.isHit) continue;
+
+			RNG rng(x + y * width, 0);
+			Ray bounce(hit.position + EPSILON * hit.normal, DiffuseDirection(hit.normal, rng));
+			scene.GetIntersection(bounce);
+			numRays++;
+		}
+		return numRays;
+	});
+
+	// --- Full render, complete passes of one sample per pixel
+	CPURaytracer raytracer(&scene, width, height, m_settings.numThreads);
+	raytracer.SetFrameBudget(0);
+	raytracer.SetMaxSamples(m_settings.samplesPerPixel);
+	raytracer.SetWavefront(m_settings.wavefront);
+	auto renderStart = Clock::now();
+	for (uint32_t sample = 0; sample < m_settings.samplesPerPixel; sample++) {
+		raytracer.RenderFrame();
+	}
+	double renderSeconds = SecondsSince(renderStart);
+	result.samplesPerSecond = renderSeconds > 0 ? double(width) * height * m_settings.samplesPerPixel / renderSeconds : 0;
+
+	return result;
+}
+
+bool Benchmark::SaveJSON(
+	const std::string& fileName
+) const {
+	std::ofstream file(fileName);
+	if (!file) {
+		return false;
+	}
+
+	std::time_t now = std::time(nullptr);
+	char date[32];
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+	file << "{\n"
+		<< "  \"date\": \"" << date << "\",\n"
+		<< "  \"settings\": {\n"
+		<< "    \"width\": " << m_settings.width << ",\n"
+		<< "    \"height\": " << m_settings.height << ",\n"
+		<< "    \"threads\": " << m_threadPool.GetNumThreads() << ",\n"
+		<< "    \"accel\": \"" << EscapeJSON(m_settings.accelStructure) << "\",\n"
+		<< "    \"iterations\": " << m_settings.iterations << ",\n"
+		<< "    \"wavefront\": " << (m_settings.wavefront ? "true" : "false") << ",\n"
+		<< "    \"samplesPerPixel\": " << m_settings.samplesPerPixel << "\n"
+		<< "  },\n"
+		<< "  \"results\": [";
+
+	for (size_t i = 0; i < m_results.size(); i++) {
+		const Result& r = m_results[i];
+		file << (i == 0 ? "\n" : ",\n")
+			<< "    {\n"
+			<< "      \"scene\": \"" << EscapeJSON(r.sceneFile) << "\",\n"
+			<< "      \"geometries\": " << r.numGeometries << ",\n"
+			<< "      \"triangles\": " << r.numTriangles << ",\n"
+			<< "      \"loadSeconds\": " << r.loadSeconds << ",\n"
+			<< "      \"buildSeconds\": " << r.buildSeconds << ",\n"
+			<< "      \"accelBytes\": " << r.accelBytes << ",\n"
+			<< "      \"geometryBytes\": " << r.geometryBytes << ",\n"
+			<< "      \"primaryHitRatio\": " << r.primaryHitRatio << ",\n"
+			<< "      \"primaryRaysPerSecond\": " << r.primaryRaysPerSecond << ",\n"
+			<< "      \"primaryPacketRaysPerSecond\": " << r.primaryPacketRaysPerSecond << ",\n"
+			<< "      \"shadowRaysPerSecond\": " << r.shadowRaysPerSecond << ",\n"
+			<< "      \"bounceRaysPerSecond\": " << r.bounceRaysPerSecond << ",\n"
+			<< "      \"samplesPerSecond\": " << r.samplesPerSecond << "\n"
+			<< "    }";
+	}
+	file << "\n  ]\n}\n";
+
+	return file.good();
+}
+
+bool Benchmark::SaveCSV(
+	const std::string& fileName
+) const {
+	std::ofstream file(fileName);
+	if (!file) {
+		return false;
+	}
+
+	file << "scene,geometries,triangles,loadSeconds,buildSeconds,accelBytes,geometryBytes,primaryHitRatio,"
+		<< "primaryRaysPerSecond,primaryPacketRaysPerSecond,shadowRaysPerSecond,bounceRaysPerSecond,samplesPerSecond\n";
+	for (const Result& r : m_results) {
+		file << r.sceneFile << ","
+			<< r.numGeometries << ","
+			<< r.numTriangles << ","
+			<< r.loadSeconds << ","
+			<< r.buildSeconds << ","
+			<< r.accelBytes << ","
+			<< r.geometryBytes << ","
+			<< r.primaryHitRatio << ","
+			<< r.primaryRaysPerSecond << ","
+			<< r.primaryPacketRaysPerSecond << ","
+			<< r.shadowRaysPerSecond << ","
+			<< r.bounceRaysPerSecond << ","
+			<< r.samplesPerSecond << "\n";
+	}
+
+	return file.good();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "scene/Scene.h"
+#include "renderer/ThreadPool.h"
+#include <string>
+#include <vector>
+
+/**
+ * \brief Headless ray tracing benchmark. Each scene is loaded in turn and rays are timed per kind from the
+ * scene's fixed camera: primary rays through pixel centers, alone and in packets, shadow rays from the
+ * primary hits to every light, and one diffuse bounce from each primary hit. Results go to a JSON or CSV
+ * file so they can be compared between versions.
+ */
+class Benchmark {
+public:
+
+	struct Settings {
+		std::vector<std::string> sceneFiles;
+		std::string outputFile = "benchmark.json"; // .json or .csv
+		uint32_t width = 800;
+		uint32_t height = 600;
+		uint32_t numThreads = 0; // One per hardware thread
+		std::string accelStructure = "QBVH";
+		bool wavefront = false; // Full render traces tiles in ray batches
+
+		// Every ray kernel runs this many times, rates are averaged over all of them
+		uint32_t iterations = 4;
+
+		// Samples per pixel of the full render timed after the ray kernels
+		uint32_t samplesPerPixel = 4;
+	};
+
+	struct Result {
+		std::string sceneFile;
+		size_t numGeometries = 0;
+		size_t numTriangles = 0; // Loaded from the glTF file, instanced meshes counted once
+		float loadSeconds = 0; // Includes the build
+		float buildSeconds = 0;
+		size_t accelBytes = 0;
+		size_t geometryBytes = 0;
+		double primaryRaysPerSecond = 0;
+		double primaryPacketRaysPerSecond = 0; // Same rays, traced RAY_PACKET_SIZE pixels at a time
+		double shadowRaysPerSecond = 0;
+		double bounceRaysPerSecond = 0;
+		double samplesPerSecond = 0; // Full shading, bounces and shadows included
+		float primaryHitRatio = 0;
+	};
+
+	Benchmark(const Settings& settings);
+
+	/**
+	 * \brief Benchmarks every scene and writes the output file
+	 * \return false if the output couldn't be written
+	 */
+	bool Run();
+
+	const std::vector<Result>& GetResults() const {
+		return m_results;
+	}
+
+	/**
+	 * \brief The bundled glTF scenes the loader can read. Cornell is left out, its WEB3D_quantized_attributes
+	 * accessors load no triangles.
+	 */
+	static std::vector<std::string> GetDefaultScenes();
+
+private:
+	Result
+	RunScene(const std::string& sceneFile);
+
+	bool
+	SaveJSON(const std::string& fileName) const;
+
+	bool
+	SaveCSV(const std::string& fileName) const;
+
+	Settings m_settings;
+	std::vector<Result> m_results;
+	ThreadPool m_threadPool;
+};
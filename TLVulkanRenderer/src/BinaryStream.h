@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Typedef.h"
+
+/**
+ * \brief Appends plain data to a byte buffer. Values are written as their in-memory bytes, so T must be
+ * plain data and files are only meant to be read back by the same build on the same kind of machine.
+ */
+class BinaryWriter
+{
+public:
+	template<typename T>
+	void Write(const T& value) {
+		WriteBytes(&value, sizeof(T));
+	}
+
+	/**
+	 * \brief Element count followed by the elements
+	 */
+	template<typename T>
+	void WriteArray(const std::vector<T>& values) {
+		Write<uint64_t>(values.size());
+		if (!values.empty()) {
+			WriteBytes(values.data(), values.size() * sizeof(T));
+		}
+	}
+
+	void WriteString(const std::string& value) {
+		Write<uint64_t>(value.size());
+		WriteBytes(value.data(), value.size());
+	}
+
+	void WriteBytes(const void* data, size_t size) {
+		const Byte* bytes = static_cast<const Byte*>(data);
+		m_bytes.insert(m_bytes.end(), bytes, bytes + size);
+	}
+
+	const std::vector<Byte>& GetBytes() const {
+		return m_bytes;
+	}
+
+private:
+	std::vector<Byte> m_bytes;
+};
+
+/**
+ * \brief Reads back what BinaryWriter wrote, typically straight from a mapped file. Every read is bounds
+ * checked and fails rather than reading past the end, so a truncated file is simply rejected.
+ */
+class BinaryReader
+{
+public:
+	BinaryReader(const Byte* data, size_t size) :
+		m_data(data),
+		m_size(size),
+		m_offset(0)
+	{}
+
+	template<typename T>
+	bool Read(T& value) {
+		return ReadBytes(&value, sizeof(T));
+	}
+
+	template<typename T>
+	bool ReadArray(std::vector<T>& values) {
+		uint64_t count;
+		if (!Read(count) || count > (m_size - m_offset) / sizeof(T)) {
+			return false;
+		}
+		values.resize(static_cast<size_t>(count));
+		return count == 0 || ReadBytes(values.data(), values.size() * sizeof(T));
+	}
+
+	bool ReadString(std::string& value) {
+		uint64_t size;
+		if (!Read(size) || size > m_size - m_offset) {
+			return false;
+		}
+		value.assign(reinterpret_cast<const char*>(m_data + m_offset), static_cast<size_t>(size));
+		m_offset += static_cast<size_t>(size);
+		return true;
+	}
+
+	bool ReadBytes(void* data, size_t size) {
+		if (size > m_size - m_offset) {
+			return false;
+		}
+		memcpy(data, m_data + m_offset, size);
+		m_offset += size;
+		return true;
+	}
+
+	size_t GetOffset() const {
+		return m_offset;
+	}
+
+	void SetOffset(size_t offset) {
+		m_offset = offset < m_size ? offset : m_size;
+	}
+
+private:
+	const Byte* m_data;
+	size_t m_size;
+	size_t m_offset;
+};
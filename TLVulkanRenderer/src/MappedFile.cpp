@@ -0,0 +1,131 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+	m_data(nullptr),
+	m_size(0),
+	m_isOpen(false)
+#ifdef _WIN32
+	, m_file(nullptr),
+	m_mapping(nullptr)
+#endif
+{}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& fileName) {
+	Close();
+
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	m_file = file;
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+	m_isOpen = true;
+
+	// Zero length files can't be mapped
+	if (m_size == 0) {
+		return true;
+	}
+
+	m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping == nullptr) {
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<const Byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close() {
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+	}
+	if (m_file) {
+		CloseHandle(m_file);
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+	m_isOpen = false;
+	m_file = nullptr;
+	m_mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& fileName) {
+	Close();
+
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = static_cast<size_t>(fileStat.st_size);
+	void* data = nullptr;
+	if (size > 0) {
+		data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	// The mapping keeps its own reference to the file
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	m_data = static_cast<const Byte*>(data);
+	m_size = size;
+	m_isOpen = true;
+	return true;
+}
+
+void MappedFile::Close() {
+	if (m_data) {
+		munmap(const_cast<Byte*>(m_data), m_size);
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+	m_isOpen = false;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include "Typedef.h"
+
+/**
+ * \brief Read-only memory mapping of a whole file. Pages are read on first access by the OS and shared with
+ * its file cache, so large binary payloads are never copied into a heap buffer. The bytes stay valid until
+ * Close() or destruction.
+ */
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * \brief Maps the file, closing the previous mapping if any
+	 * \param fileName
+	 * \return false if the file couldn't be opened or mapped. An empty file is mapped as 0 bytes.
+	 */
+	bool
+	Open(
+		const std::string& fileName
+	);
+
+	void
+	Close();
+
+	const Byte* GetData() const {
+		return m_data;
+	}
+
+	size_t GetSize() const {
+		return m_size;
+	}
+
+	bool IsOpen() const {
+		return m_isOpen;
+	}
+
+private:
+	const Byte* m_data;
+	size_t m_size;
+	bool m_isOpen;
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#endif
+};
@@ -0,0 +1,65 @@
+#include "OfflineRenderer.h"
+#include "renderer/CPURaytracer.h"
+#include <chrono>
+#include <iostream>
+
+OfflineRenderer::OfflineRenderer(
+	const Settings& settings
+) : m_settings(settings), m_scene(nullptr) {
+}
+
+OfflineRenderer::~OfflineRenderer() {
+	delete m_scene;
+}
+
+bool OfflineRenderer::Run() {
+	std::map<std::string, std::string> config = {
+		{ "USE_SBVH", "true" },
+		{ "ACCEL_STRUCTURE", m_settings.accelStructure },
+		{ "SCENE_CACHE", m_settings.sceneCache ? "true" : "false" }
+	};
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	m_scene = new Scene(m_settings.sceneFile, config);
+
+	Camera& camera = m_scene->camera;
+	camera.resolution = glm::ivec2(m_settings.width, m_settings.height);
+	camera.aspect = float(m_settings.width) / m_settings.height;
+	if (m_settings.overrideCamera) {
+		camera.eye = m_settings.eye;
+		camera.lookAt = m_settings.lookAt;
+	}
+	if (m_settings.fovDegrees > 0) {
+		camera.fov = glm::radians(m_settings.fovDegrees);
+	}
+	camera.lensRadius = m_settings.lensRadius;
+	camera.focalDistance = m_settings.focalDistance > 0 ? m_settings.focalDistance : glm::distance(camera.eye, camera.lookAt);
+	camera.RecomputeAttributes();
+
+	auto loadedTime = std::chrono::high_resolution_clock::now();
+
+	// Every frame is a complete pass adding one sample per pixel
+	CPURaytracer raytracer(m_scene, m_settings.width, m_settings.height, m_settings.numThreads);
+	raytracer.SetFrameBudget(0);
+	raytracer.SetMaxSamples(m_settings.samplesPerPixel);
+	raytracer.SetWavefront(m_settings.wavefront);
+	for (uint32_t sample = 0; sample < m_settings.samplesPerPixel; sample++) {
+		raytracer.RenderFrame();
+	}
+
+	auto renderedTime = std::chrono::high_resolution_clock::now();
+	std::cout << "Scene load and build: " << std::chrono::duration<float>(loadedTime - startTime).count() << "s" << std::endl;
+	std::cout << "Render: " << std::chrono::duration<float>(renderedTime - loadedTime).count() << "s, "
+		<< m_settings.samplesPerPixel << " spp on " << raytracer.GetNumThreads() << " threads" << std::endl;
+
+	const std::string& fileName = m_settings.outputFile;
+	bool isPPM = fileName.size() >= 4 && fileName.compare(fileName.size() - 4, 4, ".ppm") == 0;
+	bool saved = isPPM ? raytracer.GetFilm().SavePPM(fileName) : raytracer.GetFilm().SavePFM(fileName);
+	if (!saved) {
+		std::cout << "Failed to write " << fileName << std::endl;
+		return false;
+	}
+
+	std::cout << "Saved " << fileName << std::endl;
+	return true;
+}
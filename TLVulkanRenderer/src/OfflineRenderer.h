@@ -0,0 +1,45 @@
+#pragma once
+
+#include "scene/Scene.h"
+#include <string>
+
+/**
+ * \brief Renders a scene with the CPU ray tracer and saves the image, without opening a window or
+ * touching any graphics device. Meant for machines with no display or GPU.
+ */
+class OfflineRenderer {
+public:
+
+	struct Settings {
+		std::string sceneFile;
+		std::string outputFile = "render.pfm"; // .pfm for float output, .ppm for 8 bit
+		uint32_t width = 800;
+		uint32_t height = 600;
+		uint32_t samplesPerPixel = 64;
+		uint32_t numThreads = 0; // One per hardware thread
+		std::string accelStructure = "QBVH";
+		bool wavefront = false; // Trace tiles in ray batches, same image
+		bool sceneCache = false; // Load the scene and its BVH from a cache file next to it, written on first use
+
+		// The scene's camera is kept unless these are set
+		bool overrideCamera = false;
+		glm::vec3 eye;
+		glm::vec3 lookAt;
+		float fovDegrees = 0; // 0 keeps the scene's field of view
+		float lensRadius = 0; // Depth of field, 0 for a pinhole camera
+		float focalDistance = 0; // 0 focuses on the look at point
+	};
+
+	OfflineRenderer(const Settings& settings);
+	~OfflineRenderer();
+
+	/**
+	 * \brief Loads the scene, renders every sample and writes the output file
+	 * \return false if the output couldn't be written
+	 */
+	bool Run();
+
+private:
+	Settings m_settings;
+	Scene* m_scene;
+};
@@ -0,0 +1,156 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+// Bounds the memory a forgotten profiling session can take, about 24 MB per thread
+const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+std::atomic<bool> Profiler::s_enabled{false};
+const std::chrono::steady_clock::time_point Profiler::s_epoch = std::chrono::steady_clock::now();
+std::mutex Profiler::s_buffersMutex;
+std::vector<std::unique_ptr<Profiler::ThreadBuffer>> Profiler::s_buffers;
+
+Profiler::ThreadBuffer* Profiler::GetThreadBuffer() {
+	thread_local ThreadBuffer* buffer = nullptr;
+	if (buffer == nullptr) {
+		std::unique_ptr<ThreadBuffer> newBuffer(new ThreadBuffer());
+		std::fill(newBuffer->counters, newBuffer->counters + NumCounters, 0);
+		newBuffer->numDroppedEvents = 0;
+
+		std::lock_guard<std::mutex> lock(s_buffersMutex);
+		newBuffer->threadId = s_buffers.size();
+		buffer = newBuffer.get();
+		s_buffers.push_back(std::move(newBuffer));
+	}
+	return buffer;
+}
+
+void Profiler::RecordEvent(
+	const char* name,
+	int64_t startNs,
+	int64_t durationNs
+) {
+	ThreadBuffer* buffer = GetThreadBuffer();
+	if (buffer->events.size() >= MAX_EVENTS_PER_THREAD) {
+		buffer->numDroppedEvents++;
+		return;
+	}
+	buffer->events.push_back({ name, startNs, durationNs });
+}
+
+void Profiler::Reset() {
+	std::lock_guard<std::mutex> lock(s_buffersMutex);
+	for (auto& buffer : s_buffers) {
+		buffer->events.clear();
+		std::fill(buffer->counters, buffer->counters + NumCounters, 0);
+		buffer->numDroppedEvents = 0;
+	}
+}
+
+const char* Profiler::GetCounterName(
+	ECounter counter
+) {
+	static const char* names[NumCounters] = {
+		"Nodes visited",
+		"Triangles tested",
+		"Primary rays",
+		"Bounce rays",
+		"Shadow rays"
+	};
+	return names[counter];
+}
+
+bool Profiler::SaveChromeTrace(
+	const std::string& fileName
+) {
+	std::ofstream file(fileName);
+	if (!file) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(s_buffersMutex);
+
+	// Timestamps are in microseconds
+	file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	bool isFirst = true;
+	int64_t endNs = 0;
+	for (auto& buffer : s_buffers) {
+		for (const Event& e : buffer->events) {
+			file << (isFirst ? "" : ",\n")
+				<< "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadId
+				<< ",\"ts\":" << e.startNs / 1000.0 << ",\"dur\":" << e.durationNs / 1000.0 << "}";
+			isFirst = false;
+			endNs = std::max(endNs, e.startNs + e.durationNs);
+		}
+	}
+
+	for (auto& buffer : s_buffers) {
+		file << (isFirst ? "" : ",\n")
+			<< "{\"name\":\"Counters\",\"ph\":\"C\",\"pid\":0,\"tid\":" << buffer->threadId
+			<< ",\"ts\":" << endNs / 1000.0 << ",\"args\":{";
+		for (int c = 0; c < NumCounters; c++) {
+			file << (c == 0 ? "" : ",") << "\"" << GetCounterName(ECounter(c)) << "\":" << buffer->counters[c];
+		}
+		file << "}}";
+		isFirst = false;
+	}
+	file << "\n]}\n";
+
+	return file.good();
+}
+
+void Profiler::PrintSummary() {
+	struct ScopeStats {
+		uint64_t calls = 0;
+		int64_t totalNs = 0;
+		int64_t maxNs = 0;
+	};
+
+	std::lock_guard<std::mutex> lock(s_buffersMutex);
+
+	std::map<std::string, ScopeStats> scopes;
+	uint64_t counters[NumCounters] = {};
+	uint64_t numDroppedEvents = 0;
+	for (auto& buffer : s_buffers) {
+		for (const Event& e : buffer->events) {
+			ScopeStats& stats = scopes[e.name];
+			stats.calls++;
+			stats.totalNs += e.durationNs;
+			stats.maxNs = std::max(stats.maxNs, e.durationNs);
+		}
+		for (int c = 0; c < NumCounters; c++) {
+			counters[c] += buffer->counters[c];
+		}
+		numDroppedEvents += buffer->numDroppedEvents;
+	}
+
+	// Times summed over every thread, so parallel scopes can add up to more than the wall time
+	std::cout << std::left << std::setw(32) << "Scope"
+		<< std::right << std::setw(10) << "Calls"
+		<< std::setw(14) << "Total ms"
+		<< std::setw(14) << "Mean us"
+		<< std::setw(14) << "Max us" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	for (auto& scope : scopes) {
+		const ScopeStats& stats = scope.second;
+		std::cout << std::left << std::setw(32) << scope.first
+			<< std::right << std::setw(10) << stats.calls
+			<< std::setw(14) << stats.totalNs / 1e6
+			<< std::setw(14) << stats.totalNs / 1e3 / stats.calls
+			<< std::setw(14) << stats.maxNs / 1e3 << std::endl;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+
+	for (int c = 0; c < NumCounters; c++) {
+		std::cout << std::left << std::setw(32) << GetCounterName(ECounter(c))
+			<< std::right << std::setw(10) << counters[c] << std::endl;
+	}
+	std::cout << std::right;
+
+	if (numDroppedEvents > 0) {
+		std::cout << "Dropped " << numDroppedEvents << " events past the per thread limit" << std::endl;
+	}
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Comment out to compile every probe away. Compiled in, probes cost a relaxed load and a branch
+// until the profiler is enabled at runtime.
+#define ENABLE_PROFILER
+
+/**
+ * \brief Totals accumulated by the hot paths, per thread
+ */
+enum ECounter {
+	NodesVisited = 0,
+	TrianglesTested,
+	PrimaryRays,
+	BounceRays,
+	ShadowRays,
+	NumCounters
+};
+
+/**
+ * \brief Scoped timers and counters. Every thread records into its own buffer, so probes never take a
+ * lock or touch a shared cache line. The buffers are only read by SaveChromeTrace and PrintSummary,
+ * which must be called while no other thread is recording, typically between frames or at exit.
+ */
+class Profiler
+{
+public:
+	struct Event {
+		const char* name; // Must be a string literal, only the pointer is stored
+		int64_t startNs;
+		int64_t durationNs;
+	};
+
+	struct ThreadBuffer {
+		uint32_t threadId;
+		std::vector<Event> events;
+		uint64_t counters[NumCounters];
+		uint64_t numDroppedEvents;
+	};
+
+	static void SetEnabled(bool enabled) {
+		s_enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	static bool IsEnabled() {
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * \brief Nanoseconds since the profiler started
+	 */
+	static int64_t Now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+	}
+
+	static void
+	RecordEvent(
+		const char* name,
+		int64_t startNs,
+		int64_t durationNs
+	);
+
+	static void Count(ECounter counter, uint64_t amount) {
+		if (IsEnabled()) {
+			GetThreadBuffer()->counters[counter] += amount;
+		}
+	}
+
+	/**
+	 * \brief Drops every event and counter recorded so far
+	 */
+	static void
+	Reset();
+
+	/**
+	 * \brief Writes every event as a complete event in the Chrome trace format, viewable in chrome://tracing
+	 * or Perfetto. Counter totals are attached as one counter event per thread.
+	 * \return false if the file couldn't be written
+	 */
+	static bool
+	SaveChromeTrace(
+		const std::string& fileName
+	);
+
+	/**
+	 * \brief Prints call count and timings per scope name, and the counter totals of all threads
+	 */
+	static void
+	PrintSummary();
+
+	static const char*
+	GetCounterName(ECounter counter);
+
+private:
+	static ThreadBuffer*
+	GetThreadBuffer();
+
+	static std::atomic<bool> s_enabled;
+	static const std::chrono::steady_clock::time_point s_epoch;
+
+	// Buffers outlive their threads so short lived build threads still show up in the trace
+	static std::mutex s_buffersMutex;
+	static std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+};
+
+/**
+ * \brief Records the time between its construction and destruction as one event
+ */
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name) :
+		m_name(Profiler::IsEnabled() ? name : nullptr),
+		m_startNs(m_name ? Profiler::Now() : 0)
+	{}
+
+	~ProfileScope() {
+		if (m_name) {
+			Profiler::RecordEvent(m_name, m_startNs, Profiler::Now() - m_startNs);
+		}
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* m_name;
+	int64_t m_startNs;
+};
+
+/**
+ * \brief Traversal work of one ray, kept in locals and added to the thread's counters once when it goes
+ * out of scope. Kernels that don't record stats use the disabled version, which compiles to nothing.
+ */
+template<bool IsEnabled>
+struct TraversalCounters
+{
+	uint32_t numNodesVisited = 0;
+	uint32_t numTrianglesTested = 0;
+
+	~TraversalCounters();
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef ENABLE_PROFILER
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(counter, amount) Profiler::Count(counter, amount)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(counter, amount)
+#endif
+
+template<bool IsEnabled>
+inline TraversalCounters<IsEnabled>::~TraversalCounters() {
+	if (IsEnabled) {
+		PROFILE_COUNT(NodesVisited, numNodesVisited);
+		PROFILE_COUNT(TrianglesTested, numTrianglesTested);
+	}
+}
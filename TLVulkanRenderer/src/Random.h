@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * \brief PCG32 random number generator (http://www.pcg-random.org). A few bytes of state and no locking,
+ * so every render thread owns its own instance. Seeding from the pixel and sample index makes each sample
+ * draw the same numbers no matter which thread traces it, so renders are reproducible.
+ */
+class RNG
+{
+public:
+	RNG() {
+		Seed(0, 0);
+	}
+
+	/**
+	 * \param pixelIndex : selects the stream, pixels never share a sequence
+	 * \param sampleIndex : position inside the pixel's stream
+	 */
+	RNG(uint32_t pixelIndex, uint32_t sampleIndex) {
+		Seed(sampleIndex, pixelIndex);
+	}
+
+	void Seed(uint64_t initState, uint64_t initSequence) {
+		m_state = 0;
+		m_increment = (initSequence << 1u) | 1u;
+		NextUInt();
+		m_state += initState;
+		NextUInt();
+	}
+
+	uint32_t NextUInt() {
+		uint64_t oldState = m_state;
+		m_state = oldState * 6364136223846793005ULL + m_increment;
+		uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+		uint32_t rotation = static_cast<uint32_t>(oldState >> 59u);
+		return (xorShifted >> rotation) | (xorShifted << ((~rotation + 1u) & 31));
+	}
+
+	/**
+	 * \brief Uniform float in [0, 1)
+	 */
+	float NextFloat() {
+		// Keep the 24 bits a float mantissa can hold so the result never rounds up to 1
+		return (NextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+private:
+	uint64_t m_state;
+	uint64_t m_increment;
+};
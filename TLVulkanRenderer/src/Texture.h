@@ -41,6 +41,24 @@ public:
 
 		return glm::vec3(r, g, b);
 	}
+
+	const std::string& GetName() const {
+		return name;
+	}
+
+	int GetWidth() const {
+		return width;
+	}
+
+	int GetHeight() const {
+		return height;
+	}
+
+	// Decoded 8 bit pixels, row after row
+	const std::vector<unsigned char>& GetData() const {
+		return image;
+	}
+
 private:
 	std::string name;
 	int width;
@@ -1,6 +1,13 @@
 #pragma once
 #include "geometry/Geometry.h"
 #include <memory>
+#include <string>
+
+class BinaryReader;
+class BinaryWriter;
+
+// Rays traced together by the packet queries
+const uint32_t RAY_PACKET_SIZE = 8;
 
 struct SWireframe
 {
@@ -11,9 +18,54 @@ struct SWireframe
 class AccelStructure
 {
 public:
+	virtual ~AccelStructure() {}
+
 	virtual void Build(std::vector<std::shared_ptr<Geometry>>& geoms) = 0;	
 	virtual Intersection GetIntersection(Ray& r) = 0;
-	virtual bool DoesIntersect(Ray& r) = 0;
+	// Closest hit in (0, tMax), for traversals nested in another one that already has a hit at tMax
+	virtual Intersection GetIntersection(Ray& r, float tMax) = 0;
+	// Occlusion query, true as soon as anything is hit in (0, tMax)
+	virtual bool DoesIntersect(Ray& r, float tMax) = 0;
+	// Same, ignoring hits on excludeTriangle, the triangle a secondary ray leaves from
+	virtual bool DoesIntersect(Ray& r, float tMax, const TriangleRef& excludeTriangle) = 0;
+	// Closest hits of a bundle of rays, isxs[i] belongs to rays[i]. Structures with a packet kernel trace
+	// coherent rays together, the default traces them one at a time.
+	virtual void GetIntersectionPacket(Ray* rays, uint32_t numRays, Intersection* isxs) {
+		for (uint32_t i = 0; i < numRays; i++) {
+			isxs[i] = GetIntersection(rays[i]);
+		}
+	}
+	// Occlusion of a bundle of rays, each with its own tMax and excluded triangle
+	virtual void DoesIntersectPacket(Ray* rays, uint32_t numRays, const float* tMax, const TriangleRef* excludeTriangles, bool* occluded) {
+		for (uint32_t i = 0; i < numRays; i++) {
+			occluded[i] = DoesIntersect(rays[i], tMax[i], excludeTriangles[i]);
+		}
+	}
+
 	virtual void GenerateVertices(std::vector<uint16>& indices, std::vector<SWireframe>& vertices) = 0;
+	// Bytes held by the structure itself, the geometries it points to aren't counted
+	virtual size_t GetMemoryFootprint() const = 0;
 	virtual void Destroy() = 0;
+	// Describes every build parameter, so a cached structure is only reused by one that would build the
+	// same thing. Structures that can't be cached return an empty key.
+	virtual std::string GetCacheKey() const {
+		return std::string();
+	}
+	// Writes the built structure for the scene cache, geometries are stored as their index in geoms
+	virtual bool Serialize(BinaryWriter& out, const std::vector<std::shared_ptr<Geometry>>& geoms) const {
+		return false;
+	}
+	// Replaces Build with a structure written by Serialize over the same geometries in the same order
+	virtual bool Deserialize(BinaryReader& in, std::vector<std::shared_ptr<Geometry>>& geoms) {
+		return false;
+	}
+
+	// Traversal updates Ray::m_traversalCost and the profiler counters only when enabled. The cost of the
+	// bottom level traversals instances run is reported through GeometryQuery and added on the way out.
+	void SetRecordStats(bool recordStats) {
+		m_recordStats = recordStats;
+	}
+
+protected:
+	bool m_recordStats = false;
 };
@@ -0,0 +1,92 @@
+#include "Instance.h"
+
+Instance::Instance(
+	const std::shared_ptr<BottomLevelAccel>& bottomLevel,
+	const glm::mat4& transform
+) : m_bottomLevel(bottomLevel),
+	m_objectToWorld(transform),
+	m_worldToObject(glm::inverse(transform)),
+	m_normalToWorld(glm::transpose(glm::inverse(glm::mat3(transform))))
+{
+	m_material = nullptr;
+	m_area = 0;
+}
+
+Intersection Instance::GetIntersection(const Ray& r) {
+	GeometryQuery query(INFINITY, TriangleRef());
+	return GetIntersection(r, query);
+}
+
+Intersection Instance::GetIntersection(const Ray& r, GeometryQuery& query) {
+	Ray rLocal = r.GetTransformedCopy(m_worldToObject);
+
+	// Only hits in front of the traversal's closest one matter
+	Intersection isx;
+	if (m_bottomLevel->accel) {
+		isx = m_bottomLevel->accel->GetIntersection(rLocal, query.tMax);
+		query.traversalCost += rLocal.m_traversalCost;
+	}
+	else {
+		for (auto& geo : m_bottomLevel->geometries) {
+			Intersection geoIsx = geo->GetIntersection(rLocal);
+			if (geoIsx.t > 0 && geoIsx.t < query.tMax && (isx.t < 0 || geoIsx.t < isx.t)) {
+				isx = geoIsx;
+			}
+		}
+	}
+
+	if (isx.t <= 0) {
+		return Intersection();
+	}
+
+	// Back to world space, t is unchanged
+	isx.hitPoint = r.GetPointOnRay(isx.t);
+	isx.hitNormal = glm::normalize(m_normalToWorld * isx.hitNormal);
+	isx.hitTangent = glm::normalize(glm::mat3(m_objectToWorld) * isx.hitTangent);
+	isx.hitBitangent = glm::cross(isx.hitNormal, isx.hitTangent);
+	isx.hitInstance = this;
+	return isx;
+}
+
+bool Instance::DoesIntersect(const Ray& r, float tMax) {
+	GeometryQuery query(tMax, TriangleRef());
+	return DoesIntersect(r, query);
+}
+
+bool Instance::DoesIntersect(const Ray& r, GeometryQuery& query) {
+	Ray rLocal = r.GetTransformedCopy(m_worldToObject);
+
+	// The other instances of the mesh hold the same triangle, they don't skip it
+	const Geometry* excludeTriangle = query.excludeTriangle.instance == this ? query.excludeTriangle.triangle : nullptr;
+	if (m_bottomLevel->accel) {
+		bool isOccluded = excludeTriangle ?
+			m_bottomLevel->accel->DoesIntersect(rLocal, query.tMax, TriangleRef(excludeTriangle, nullptr)) :
+			m_bottomLevel->accel->DoesIntersect(rLocal, query.tMax);
+		query.traversalCost += rLocal.m_traversalCost;
+		return isOccluded;
+	}
+
+	for (auto& geo : m_bottomLevel->geometries) {
+		if (geo.get() != excludeTriangle && geo->DoesIntersect(rLocal, query.tMax)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+BBox Instance::GetBBox() {
+	const BBox& bounds = m_bottomLevel->bounds;
+
+	// World space box around the transformed object space corners
+	BBox bbox;
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 p(
+			corner & 1 ? bounds.m_max.x : bounds.m_min.x,
+			corner & 2 ? bounds.m_max.y : bounds.m_min.y,
+			corner & 4 ? bounds.m_max.z : bounds.m_min.z
+		);
+		bbox = BBox::BBoxUnion(bbox, glm::vec3(m_objectToWorld * glm::vec4(p, 1.0f)));
+	}
+	bbox.m_centroid = BBox::Centroid(bbox.m_min, bbox.m_max);
+	return bbox;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "AccelStructure.h"
+#include <geometry/BBox.h>
+#include <memory>
+
+/**
+ * \brief Bottom level of the two level structure: the triangles of one instanced glTF mesh in object space,
+ * and the structure built over them. Every Instance of the mesh shares it.
+ */
+struct BottomLevelAccel
+{
+	std::vector<std::shared_ptr<Geometry>> geometries;
+	std::unique_ptr<AccelStructure> accel; // Null when the scene traces without acceleration structure
+	BBox bounds; // Object space
+};
+
+/**
+ * \brief Placement of a bottom level structure in the scene, the top level structure holds these like any
+ * other geometry. Rays are moved to object space on the way in and hits back to world space on the way out.
+ * Directions aren't renormalised, so t is the same in both spaces and tMax needs no conversion.
+ *
+ * Hits keep the triangle as hitObject, so materials work as for baked triangles, and record the instance as
+ * hitInstance. A shadow ray leaving an instanced triangle only skips it in that same instance.
+ */
+class Instance : public Geometry
+{
+public:
+	Instance(
+		const std::shared_ptr<BottomLevelAccel>& bottomLevel,
+		const glm::mat4& transform
+	);
+
+	Intersection GetIntersection(const Ray& r) override;
+	Intersection GetIntersection(const Ray& r, GeometryQuery& query) override;
+	bool DoesIntersect(const Ray& r, float tMax) override;
+	bool DoesIntersect(const Ray& r, GeometryQuery& query) override;
+
+	UV GetUV(const vec3& point) const override {
+		return vec2();
+	}
+
+	BBox GetBBox() override;
+
+protected:
+	std::shared_ptr<BottomLevelAccel> m_bottomLevel;
+	glm::mat4 m_objectToWorld;
+	glm::mat4 m_worldToObject;
+	glm::mat3 m_normalToWorld;
+};
@@ -0,0 +1,425 @@
+#include "QBVH.h"
+#include "BinaryStream.h"
+#include "Profiler.h"
+#include "TraversalPolicy.h"
+#include <iostream>
+#include <sstream>
+
+struct QBVHStackEntry
+{
+	uint32_t index;
+	int32_t numBlocks; // Negative for interior nodes
+	float tNear;
+};
+
+void
+QBVH::Build(
+	std::vector<std::shared_ptr<Geometry>>& geoms
+)
+{
+	SBVH::Build(geoms);
+	{
+		PROFILE_SCOPE("QBVH::Collapse");
+		Collapse();
+	}
+
+	std::cout << "Number of QBVH nodes: " << m_qnodes.size() << std::endl;
+}
+
+/**
+ * \brief Puts a binary node in the next free slot of qnode. Empty leaves are dropped and interior nodes
+ * are collapsed recursively.
+ */
+static void
+AddChild(
+	QBVHNode& qnode,
+	const LinearSBVHNode& child,
+	uint32_t interiorIdx
+	)
+{
+	if (child.m_isLeaf && child.m_numPrims == 0)
+	{
+		return;
+	}
+
+	int slot = qnode.m_numChildren++;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		qnode.m_min[axis][slot] = child.m_bounds.m_min[axis];
+		qnode.m_max[axis][slot] = child.m_bounds.m_max[axis];
+	}
+
+	if (child.m_isLeaf)
+	{
+		qnode.m_children[slot] = child.m_primitivesOffset;
+		qnode.m_numBlocks[slot] = child.m_numPrims;
+		qnode.m_leafMask |= 1 << slot;
+	}
+	else
+	{
+		qnode.m_children[slot] = interiorIdx;
+	}
+}
+
+static QBVHNode
+EmptyQBVHNode()
+{
+	QBVHNode qnode = {};
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int slot = 0; slot < QBVH_WIDTH; slot++)
+		{
+			qnode.m_min[axis][slot] = INFINITY;
+			qnode.m_max[axis][slot] = -INFINITY;
+		}
+	}
+	return qnode;
+}
+
+void QBVH::Collapse()
+{
+	m_qnodes.clear();
+	if (m_nodes.empty())
+	{
+		return;
+	}
+
+	if (m_nodes[0].m_isLeaf)
+	{
+		// Whole scene fits in one leaf, hang it under a single wide node
+		QBVHNode root = EmptyQBVHNode();
+		AddChild(root, m_nodes[0], 0);
+		m_qnodes.push_back(root);
+		return;
+	}
+
+	CollapseRecursive(0);
+}
+
+uint32_t QBVH::CollapseRecursive(
+	uint32_t binaryNodeIdx
+	)
+{
+	uint32_t qnodeIdx = m_qnodes.size();
+	m_qnodes.push_back(QBVHNode());
+
+	// Keep opening the interior child with the largest surface area until all slots are used,
+	// that's the one rays are most likely to enter
+	uint32_t children[QBVH_WIDTH] = { binaryNodeIdx + 1, m_nodes[binaryNodeIdx].m_farChildOffset };
+	int numChildren = 2;
+	while (numChildren < QBVH_WIDTH)
+	{
+		int largest = -1;
+		float largestArea = -1;
+		for (int i = 0; i < numChildren; i++)
+		{
+			const LinearSBVHNode& child = m_nodes[children[i]];
+			if (child.m_isLeaf) continue;
+
+			float area = child.m_bounds.GetSurfaceArea();
+			if (area > largestArea)
+			{
+				largestArea = area;
+				largest = i;
+			}
+		}
+
+		if (largest < 0)
+		{
+			break;
+		}
+
+		uint32_t opened = children[largest];
+		children[largest] = opened + 1;
+		children[numChildren++] = m_nodes[opened].m_farChildOffset;
+	}
+
+	QBVHNode qnode = EmptyQBVHNode();
+	for (int i = 0; i < numChildren; i++)
+	{
+		const LinearSBVHNode& child = m_nodes[children[i]];
+		uint32_t interiorIdx = child.m_isLeaf ? 0 : CollapseRecursive(children[i]);
+		AddChild(qnode, child, interiorIdx);
+	}
+
+	m_qnodes[qnodeIdx] = qnode;
+	return qnodeIdx;
+}
+
+template<typename Policy>
+bool QBVH::Traverse(
+	Ray& r,
+	TriangleBlockHit& hit,
+	const typename Policy::TriangleFilter& filter
+	)
+{
+	if (m_qnodes.empty())
+	{
+		return false;
+	}
+
+	TraversalCounters<Policy::Stats> counters;
+	glm::vec3 invDir = 1.0f / r.m_direction;
+	int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+	__m128 origin4[3], invDir4[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		origin4[axis] = _mm_set1_ps(r.m_origin[axis]);
+		invDir4[axis] = _mm_set1_ps(invDir[axis]);
+	}
+
+	auto intersectBlocks = [&](uint32_t firstBlock, int32_t numBlocks) -> bool
+	{
+		for (int32_t i = 0; i < numBlocks; i++)
+		{
+			const TriangleBlock4& block = m_blocks[firstBlock + i];
+			if (Policy::Stats)
+			{
+				r.m_traversalCost += COST_INTERSECTION * block.m_numGeoms;
+				counters.numTrianglesTested += block.m_numGeoms;
+			}
+
+			if (Policy::AnyHit)
+			{
+				if (block.DoesIntersect(r, hit, filter))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				block.GetIntersection(r, hit, filter);
+			}
+		}
+		return false;
+	};
+
+	if (Policy::AnyHit)
+	{
+		// Any hit will do, so leaves are tested as soon as they are found and interior children are
+		// visited in whatever order they come. A plain index stack is noticeably faster here.
+		uint32_t toVisit[QBVH_STACK_SIZE];
+		int toVisitCount = 0;
+		toVisit[toVisitCount++] = 0;
+		while (toVisitCount > 0)
+		{
+			if (Policy::Stats)
+			{
+				r.m_traversalCost += COST_TRAVERSAL;
+				counters.numNodesVisited++;
+			}
+
+			const QBVHNode& node = m_qnodes[toVisit[--toVisitCount]];
+			float tNear[QBVH_WIDTH];
+			int hitMask = node.DoesIntersect(origin4, invDir4, dirIsNeg, hit.t, tNear);
+			for (int slot = 0; slot < node.m_numChildren; slot++)
+			{
+				if (!(hitMask & (1 << slot))) continue;
+
+				if (node.m_leafMask & (1 << slot))
+				{
+					if (intersectBlocks(node.m_children[slot], node.m_numBlocks[slot]))
+					{
+						return true;
+					}
+				}
+				else
+				{
+					assert(toVisitCount < QBVH_STACK_SIZE);
+					toVisit[toVisitCount++] = node.m_children[slot];
+				}
+			}
+		}
+		return false;
+	}
+
+	// Entries are pushed far to near, so the nearest child is always popped first
+	QBVHStackEntry toVisit[QBVH_STACK_SIZE];
+	int toVisitCount = 0;
+	toVisit[toVisitCount++] = { 0, -1, 0 };
+	while (toVisitCount > 0)
+	{
+		QBVHStackEntry entry = toVisit[--toVisitCount];
+
+		// A closer hit may have been found since this entry was pushed
+		if (entry.tNear > hit.t)
+		{
+			continue;
+		}
+
+		if (entry.numBlocks >= 0)
+		{
+			intersectBlocks(entry.index, entry.numBlocks);
+			continue;
+		}
+
+		if (Policy::Stats)
+		{
+			// Update ray's traversal cost for visual debugging
+			r.m_traversalCost += COST_TRAVERSAL;
+			counters.numNodesVisited++;
+		}
+
+		const QBVHNode& node = m_qnodes[entry.index];
+		float tNear[QBVH_WIDTH];
+		int hitMask = node.DoesIntersect(origin4, invDir4, dirIsNeg, hit.t, tNear);
+
+		// Insertion sort the children hit by decreasing entry distance
+		QBVHStackEntry hits[QBVH_WIDTH];
+		int numHits = 0;
+		for (int slot = 0; slot < node.m_numChildren; slot++)
+		{
+			if (!(hitMask & (1 << slot))) continue;
+
+			bool isLeaf = (node.m_leafMask & (1 << slot)) != 0;
+			QBVHStackEntry child = { node.m_children[slot], isLeaf ? node.m_numBlocks[slot] : -1, tNear[slot] };
+			int i = numHits++;
+			while (i > 0 && hits[i - 1].tNear < child.tNear)
+			{
+				hits[i] = hits[i - 1];
+				i--;
+			}
+			hits[i] = child;
+		}
+
+		assert(toVisitCount + numHits <= QBVH_STACK_SIZE);
+		for (int i = 0; i < numHits; i++)
+		{
+			toVisit[toVisitCount++] = hits[i];
+		}
+	}
+
+	return hit.triangle != nullptr || hit.isx.hitObject != nullptr;
+}
+
+Intersection QBVH::GetIntersection(Ray& r)
+{
+	return GetIntersection(r, INFINITY);
+}
+
+Intersection QBVH::GetIntersection(Ray& r, float tMax)
+{
+	// Triangle hits are only shaded once traversal has settled on the closest one
+	TriangleBlockHit hit;
+	hit.t = tMax;
+	if (m_recordStats)
+	{
+		Traverse<TraversalPolicy<false, true>>(r, hit, NoTriangleFilter());
+		r.m_traversalCost += hit.traversalCost;
+	}
+	else
+	{
+		Traverse<TraversalPolicy<false, false>>(r, hit, NoTriangleFilter());
+	}
+	return hit.Resolve(r);
+}
+
+bool QBVH::DoesIntersect(Ray& r, float tMax)
+{
+	TriangleBlockHit hit;
+	hit.t = tMax;
+	if (m_recordStats)
+	{
+		bool isOccluded = Traverse<TraversalPolicy<true, true>>(r, hit, NoTriangleFilter());
+		r.m_traversalCost += hit.traversalCost;
+		return isOccluded;
+	}
+	return Traverse<TraversalPolicy<true, false>>(r, hit, NoTriangleFilter());
+}
+
+bool QBVH::DoesIntersect(Ray& r, float tMax, const TriangleRef& excludeTriangle)
+{
+	TriangleBlockHit hit;
+	hit.t = tMax;
+	ExcludeTriangleFilter filter = { excludeTriangle };
+	if (m_recordStats)
+	{
+		bool isOccluded = Traverse<TraversalPolicy<true, true, ExcludeTriangleFilter>>(r, hit, filter);
+		r.m_traversalCost += hit.traversalCost;
+		return isOccluded;
+	}
+	return Traverse<TraversalPolicy<true, false, ExcludeTriangleFilter>>(r, hit, filter);
+}
+
+size_t QBVH::GetMemoryFootprint() const
+{
+	return SBVH::GetMemoryFootprint() + m_qnodes.capacity() * sizeof(QBVHNode);
+}
+
+void QBVH::Destroy()
+{
+	SBVH::Destroy();
+	m_qnodes.clear();
+}
+
+std::string QBVH::GetCacheKey() const
+{
+	// Collapsed from the binary tree, so the binary build parameters are part of the key
+	std::stringstream key;
+	key << "QBVH nodeSize=" << sizeof(QBVHNode) << " " << SBVH::GetCacheKey();
+	return key.str();
+}
+
+bool QBVH::HasValidQNodes() const
+{
+	std::vector<int> depths(m_qnodes.size(), 0);
+	std::vector<uint8_t> isReferenced(m_qnodes.size(), 0);
+	for (size_t i = 0; i < m_qnodes.size(); i++)
+	{
+		const QBVHNode& node = m_qnodes[i];
+		if ((i > 0 && !isReferenced[i]) || node.m_numChildren > QBVH_WIDTH)
+		{
+			return false;
+		}
+
+		for (int slot = 0; slot < node.m_numChildren; slot++)
+		{
+			uint32_t child = node.m_children[slot];
+			if (node.m_leafMask & (1 << slot))
+			{
+				if (size_t(child) + node.m_numBlocks[slot] > m_blocks.size())
+				{
+					return false;
+				}
+				continue;
+			}
+
+			if (child <= i || child >= m_qnodes.size() || isReferenced[child] || depths[i] + 1 >= MAX_TRAVERSAL_DEPTH)
+			{
+				return false;
+			}
+			isReferenced[child] = 1;
+			depths[child] = depths[i] + 1;
+		}
+	}
+	return true;
+}
+
+bool QBVH::Serialize(
+	BinaryWriter& out,
+	const std::vector<std::shared_ptr<Geometry>>& geoms
+	) const
+{
+	if (!SBVH::Serialize(out, geoms))
+	{
+		return false;
+	}
+
+	out.WriteArray(m_qnodes);
+	return true;
+}
+
+bool QBVH::Deserialize(
+	BinaryReader& in,
+	std::vector<std::shared_ptr<Geometry>>& geoms
+	)
+{
+	if (!SBVH::Deserialize(in, geoms) || !in.ReadArray(m_qnodes) || m_qnodes.empty() != m_nodes.empty() || !HasValidQNodes())
+	{
+		Destroy();
+		return false;
+	}
+
+	std::cout << "Number of QBVH nodes: " << m_qnodes.size() << " (cached)" << std::endl;
+	return true;
+}
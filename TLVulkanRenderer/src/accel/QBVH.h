@@ -0,0 +1,123 @@
+#pragma once
+
+#include "SBVH.h"
+#include <xmmintrin.h>
+
+const int QBVH_WIDTH = 4;
+
+// Each visited node pops one entry and pushes up to four, so the stack grows by three per level
+const int QBVH_STACK_SIZE = (QBVH_WIDTH - 1) * MAX_TRAVERSAL_DEPTH + 1;
+
+/**
+ * \brief 4-wide node collapsed from the binary SBVH. Children bounds are stored in SoA layout so a ray
+ * is tested against all of them with one SSE slab test. Unused child slots have inverted bounds and never hit.
+ */
+struct QBVHNode
+{
+	float m_min[3][QBVH_WIDTH];
+	float m_max[3][QBVH_WIDTH];
+	uint32_t m_children[QBVH_WIDTH]; // Interior child: index in m_qnodes. Leaf child: first entry in m_blocks
+	uint16_t m_numBlocks[QBVH_WIDTH]; // Leaf child: number of blocks
+	uint8_t m_leafMask; // Children that are leaves
+	uint8_t m_numChildren;
+
+	/**
+	* \brief Slab test against all children bounds
+	* \param origin, invDir : ray origin and reciprocal direction broadcast per axis
+	* \param dirIsNeg : per axis, whether the near plane is m_max rather than m_min
+	* \param tMax : children entered beyond this distance are rejected
+	* \param tNear : entry distance per child
+	* \return bitmask of the children hit
+	*/
+	inline int DoesIntersect(
+		const __m128 origin[3],
+		const __m128 invDir[3],
+		const int dirIsNeg[3],
+		float tMax,
+		float tNear[QBVH_WIDTH]
+	) const;
+};
+
+int QBVHNode::DoesIntersect(
+	const __m128 origin[3],
+	const __m128 invDir[3],
+	const int dirIsNeg[3],
+	float tMax,
+	float tNear[QBVH_WIDTH]
+	) const
+{
+	__m128 tEnter = _mm_setzero_ps();
+	__m128 tExit = _mm_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float* nearPlane = dirIsNeg[axis] ? m_max[axis] : m_min[axis];
+		const float* farPlane = dirIsNeg[axis] ? m_min[axis] : m_max[axis];
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearPlane), origin[axis]), invDir[axis]);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farPlane), origin[axis]), invDir[axis]);
+
+		// max/min return their second operand on NaN, so a ray lying on a slab keeps the current interval
+		tEnter = _mm_max_ps(t0, tEnter);
+		tExit = _mm_min_ps(t1, tExit);
+	}
+
+	_mm_storeu_ps(tNear, tEnter);
+	return _mm_movemask_ps(_mm_cmple_ps(tEnter, tExit));
+}
+
+static_assert(sizeof(QBVHNode) <= 128, "QBVHNode should fit in two cache lines");
+
+class QBVH : public SBVH {
+
+public:
+	QBVH() : SBVH() {};
+
+	QBVH(
+		int maxPrimInNode,
+		ESplitMethod splitMethod
+	) : SBVH(maxPrimInNode, splitMethod)
+	{}
+
+	void Build(
+		std::vector<std::shared_ptr<Geometry>>& geoms
+	) override;
+
+	Intersection GetIntersection(Ray& r) override;
+	Intersection GetIntersection(Ray& r, float tMax) override;
+	bool DoesIntersect(Ray& r, float tMax) override;
+	bool DoesIntersect(Ray& r, float tMax, const TriangleRef& excludeTriangle) override;
+
+	size_t GetMemoryFootprint() const override;
+
+	void Destroy() override;
+
+	std::string GetCacheKey() const override;
+	bool Serialize(BinaryWriter& out, const std::vector<std::shared_ptr<Geometry>>& geoms) const override;
+	bool Deserialize(BinaryReader& in, std::vector<std::shared_ptr<Geometry>>& geoms) override;
+
+	// The binary nodes are kept for GenerateVertices, traversal only uses these
+	std::vector<QBVHNode> m_qnodes;
+
+protected:
+	/**
+	 * \brief 4-wide counterpart of SBVH::Traverse, it hides the binary kernel
+	 */
+	template<typename Policy>
+	bool
+	Traverse(
+		Ray& r,
+		TriangleBlockHit& hit,
+		const typename Policy::TriangleFilter& filter
+	);
+
+	void
+	Collapse();
+
+	uint32_t
+	CollapseRecursive(uint32_t binaryNodeIdx);
+
+	/**
+	 * \brief Wide counterpart of SBVH::HasValidNodes for the loaded m_qnodes
+	 */
+	bool
+	HasValidQNodes() const;
+};
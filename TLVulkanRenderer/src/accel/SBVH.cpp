@@ -1,7 +1,17 @@
 #include "SBVH.h"
+#include "BinaryStream.h"
+#include "Profiler.h"
+#include "TraversalPolicy.h"
 #include <algorithm>
 #include <iostream>
-#include <unordered_set>
+#include <stdexcept>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+// Unused block lanes in a serialized BVH
+const uint32_t INVALID_GEOMETRY_INDEX = std::numeric_limits<uint32_t>::max();
 
 // This comparator is used to sort bvh nodes based on its centroid's maximum extent
 struct CompareCentroid
@@ -19,6 +29,7 @@ SBVH::Build(
 	std::vector<std::shared_ptr<Geometry>>& prims
 )
 {
+	PROFILE_SCOPE("SBVH::Build");
 	m_prims = prims;
 	if (prims.size() == 0) {
 		return;
@@ -31,16 +42,69 @@ SBVH::Build(
 		primInfos[i] = { i, m_prims[i]->GetBBox()};
 	}
 
-	PrimID totalNodes = 0;
+	std::atomic<PrimID> totalNodes(0);
+
+	// Traversal keeps one pending node per level on a fixed-size stack
+	assert(m_maxDepth < MAX_TRAVERSAL_DEPTH);
+
+	// Every parallel level doubles the number of build tasks, stop once there's about two per core
+	unsigned int numCores = std::max(1u, std::thread::hardware_concurrency());
+	m_maxParallelDepth = 1;
+	while ((1u << m_maxParallelDepth) < numCores)
+	{
+		m_maxParallelDepth++;
+	}
 
-	std::vector<std::shared_ptr<Geometry>> orderedGeoms;
 	PrimID first = 0;
 	PrimID last = primInfos.size();
-	m_root = BuildRecursive(first, last, totalNodes, primInfos, orderedGeoms, 0, true);
-	//m_geoms.swap(orderedGeoms);
-	Flatten();
+	m_numBusyThreads = 1;
+	{
+		PROFILE_SCOPE("SBVH::BuildRecursive");
+		m_root = BuildRecursive(first, last, totalNodes, primInfos, 0, true, SPATIAL_SPLIT_BUDGET);
+	}
+	{
+		PROFILE_SCOPE("SBVH::Flatten");
+		Flatten(primInfos);
+	}
+
+	// Traversal only touches the flattened nodes from here on, so the pointer tree can go
+	delete m_root;
+	m_root = nullptr;
+
 	std::cout << "Number of BVH nodes: " << m_nodes.size() << std::endl;
-	std::cout << "Number of spatial splits: " << m_spatialSplitCount << std::endl;
+	std::cout << "Number of spatial splits: " << m_spatialSplitCount.load() << std::endl;
+}
+
+/**
+ * \brief Partitions the valid entries of [first, last) in place. Entries matching isNear are packed at the front,
+ * the rest at the back, and the free slots end up in between so both children keep room for spatial split fragments.
+ * \return the middle of the free space, where the range should be split
+ */
+template<typename Predicate>
+static PrimID
+PartitionInPlace(
+	PrimID first,
+	PrimID last,
+	std::vector<PrimInfo>& primInfos,
+	Predicate isNear
+	)
+{
+	PrimInfo* begin = &primInfos[first];
+	PrimInfo* end = &primInfos[last - 1] + 1;
+
+	// Pack valid entries at the front and free slots at the back
+	PrimInfo* validEnd = std::partition(begin, end, [](const PrimInfo& info)
+	{
+		return info.primitiveId != INVALID_ID;
+	});
+
+	// Split the valid entries, then move the far ones behind the free slots
+	PrimInfo* nearEnd = std::partition(begin, validEnd, isNear);
+	std::rotate(nearEnd, validEnd, end);
+
+	PrimID front = first + (nearEnd - begin);
+	PrimID numFree = end - validEnd;
+	return front + numFree / 2;
 }
 
 void SBVH::PartitionEqualCounts(
@@ -67,46 +131,14 @@ void SBVH::PartitionObjects(
 	BBox& bboxCentroids
 	) {
 	
-	std::vector<PrimInfo> temp;
-	for (PrimID i = first; i < last; i++) {
-		if (primInfos[i].primitiveId == INVALID_ID) continue;
-
-		temp.push_back(primInfos.at(i));
-		// Clear out that memory
-		primInfos.at(i) = { INVALID_ID, BBox() };
-	}
-
-	PrimID front = first;
-	PrimID back = last - 1;
-	for (PrimInfo info : temp) {
+	mid = PartitionInPlace(first, last, primInfos, [&](const PrimInfo& info)
+	{
 		// Partition geometry into two halves, before and after the split, and leave the middle empty
 		int whichBucket = NUM_BUCKET * bboxCentroids.Offset(info.bbox.m_centroid)[dim];
 		assert(whichBucket <= NUM_BUCKET);
 		if (whichBucket == NUM_BUCKET) whichBucket = NUM_BUCKET - 1;
-		if(whichBucket <= minCostBucket) {
-			primInfos.at(front) = info;
-			front++;
-		} else {
-			primInfos.at(back) = info;
-			back--;
-		}
-		assert(front <= back + 1);
-
-	}
-
-	mid = (front + back) / 2;
-
-	//PrimInfo *pmid = std::partition(
-	//	&geomInfos[first], &geomInfos[last - 1] + 1,
-	//	[=](const PrimInfo& gi)
-	//{
-	//	// Partition geometry into two halves, before and after the split
-	//	int whichBucket = NUM_BUCKET * bboxCentroids.Offset(gi.bbox.m_centroid)[dim];
-	//	assert(whichBucket <= NUM_BUCKET);
-	//	if (whichBucket == NUM_BUCKET) whichBucket = NUM_BUCKET - 1;
-	//	return whichBucket <= minCostBucket;
-	//});
-	//mid = pmid - &geomInfos[0];
+		return whichBucket <= minCostBucket;
+	});
 }
 
 void SBVH::PartitionSpatial(
@@ -119,89 +151,27 @@ void SBVH::PartitionSpatial(
 	BBox& bboxAllGeoms
 	) 
 {
-	std::vector<PrimInfo> temp;
-	for (PrimID i = first; i < last; i++)
-	{
-		if (primInfos[i].primitiveId == INVALID_ID) continue;
-
-		temp.push_back(primInfos.at(i));
-		// Clear out that memory
-		primInfos.at(i) = { INVALID_ID, BBox() };
-	}
-
-	PrimID front = first;
-	PrimID back = last - 1;
-	for (PrimInfo info : temp)
+	mid = PartitionInPlace(first, last, primInfos, [&](const PrimInfo& info)
 	{
 		// Partition geometry into two halves, before and after the split, and leave the middle empty
 		BucketID startEdgeBucket = NUM_BUCKET * bboxAllGeoms.Offset(info.bbox.m_min)[dim];
 		assert(startEdgeBucket <= NUM_BUCKET);
 		if (startEdgeBucket == NUM_BUCKET) startEdgeBucket = NUM_BUCKET - 1;
-		if (startEdgeBucket <= minCostBucket)
-		{
-			primInfos.at(front) = info;
-			front++;
-		}
-		else
-		{
-			primInfos.at(back) = info;
-			back--;
-		}
-		assert(front <= back);
-
-	}
-
-	mid = (front + back) / 2;
-
-	//PrimInfo *pmid = std::partition(
-	//	&primInfos[first], &primInfos[last - 1] + 1,
-	//	[=](const PrimInfo& gi)
-	//{
-	//	BucketID startEdgeBucket = NUM_BUCKET * bboxAllGeoms.Offset(gi.bbox.m_min)[dim];;
-	//	assert(startEdgeBucket <= NUM_BUCKET);
-	//	if (startEdgeBucket == NUM_BUCKET) startEdgeBucket = NUM_BUCKET - 1;
-
-	//	return startEdgeBucket <= minCostBucket;
-	//});
-	//mid = pmid - &primInfos[0];
+		return startEdgeBucket <= minCostBucket;
+	});
 }
 
 SBVHLeaf* SBVH::CreateLeaf(
 	SBVHNode* parent,
 	PrimID first,
 	PrimID last,
-	PrimID& nodeCount,
+	std::atomic<PrimID>& nodeCount,
 	std::vector<PrimInfo>& primInfos,
-	std::vector<std::shared_ptr<Geometry>>& orderedGeoms,
 	BBox& bboxAllGeoms
 	) {
 
-	PrimID numPrimitives = 0;
-	for (auto prim : primInfos)
-	{
-		if (prim.primitiveId != INVALID_ID)
-		{
-			++numPrimitives;
-		}
-		else
-		{
-			continue;
-		}
-	}
-
-	size_t firstGeomOffset = orderedGeoms.size();
-	std::unordered_set<PrimID> geomIds;
-	for (int i = first; i < last; i++)
-	{
-		PrimID primID = primInfos.at(i).primitiveId;
-		if (primID == INVALID_ID) continue;
-
-		orderedGeoms.push_back(m_prims[primID]);
-		geomIds.insert(primID);
-	}
-	SBVHLeaf* leaf = new SBVHLeaf(parent, nodeCount, firstGeomOffset, numPrimitives, bboxAllGeoms);
-	nodeCount++;
-	leaf->m_geomIds = geomIds;
+	// The leaf takes over its whole range, geometries are gathered from it when flattening
+	SBVHLeaf* leaf = new SBVHLeaf(parent, nodeCount++, first, last - first, bboxAllGeoms);
 	return leaf;
 }
 
@@ -209,97 +179,119 @@ SBVHNode* SBVH::CreateNode(
 	SBVHNode* parent,
 	SBVHNode* nearChild,
 	SBVHNode* farChild,
-	PrimID& nodeCount,
+	std::atomic<PrimID>& nodeCount,
 	Dim dim
 	) {
-	SBVHNode* node = new SBVHNode(parent, nearChild, farChild, nodeCount, dim);
-	nodeCount++;
+	SBVHNode* node = new SBVHNode(parent, nearChild, farChild, nodeCount++, dim);
 	return node;
 }
 
-std::tuple<Cost, BucketID> 
-SBVH::CalculateObjectSplitCost(
-	Dim dim,
+/**
+ * \brief Bins [first, last) into buckets. Large ranges are split into contiguous chunks, the calling thread
+ * bins the first one and the cores no build thread is using bin the others. The chunks are merged back in
+ * order so the result matches a single-threaded pass.
+ * \param busyThreads : build threads currently running, the borrowed cores are added for the duration
+ */
+template<typename BinFunc>
+static void
+BinInParallel(
 	PrimID first,
 	PrimID last,
-	std::vector<PrimInfo>& primInfos,
-	BBox& bboxCentroids,
-	BBox& bboxAllGeoms
-	) const 
+	std::vector<BucketInfo>& buckets,
+	std::atomic<unsigned int>& busyThreads,
+	BinFunc binFunc
+	)
 {
-	BucketInfo buckets[NUM_BUCKET];
-	Cost costs[NUM_BUCKET - 1];
-	float invAllGeometriesSA = 1.0f / bboxAllGeoms.GetSurfaceArea();
-
-	// For each primitive in range, determine which bucket it falls into
-	for (int i = first; i < last; i++)
+	PrimID numEntries = last - first;
+	unsigned int numCores = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int numBusy = busyThreads.load();
+	if (numEntries < PARALLEL_BINNING_THRESHOLD || numBusy >= numCores)
 	{
-		if (primInfos[i].primitiveId == INVALID_ID) continue;
-
-		int whichBucket = NUM_BUCKET * bboxCentroids.Offset(primInfos.at(i).bbox.m_centroid)[dim];
-		assert(whichBucket <= NUM_BUCKET);
-		if (whichBucket == NUM_BUCKET) whichBucket = NUM_BUCKET - 1;
-
-		buckets[whichBucket].count++;
-		buckets[whichBucket].bbox = BBox::BBoxUnion(buckets[whichBucket].bbox, primInfos.at(i).bbox);
+		binFunc(first, last, buckets);
+		return;
 	}
 
-	// Compute cost for splitting after each bucket
-	for (int i = 0; i < NUM_BUCKET - 1; i++)
+	// Claim every idle core, subtree builds started meanwhile just find none left
+	while (numBusy < numCores && !busyThreads.compare_exchange_weak(numBusy, numCores)) {}
+	if (numBusy >= numCores)
 	{
-		BBox bbox0, bbox1;
-		int count0 = 0, count1 = 0;
+		binFunc(first, last, buckets);
+		return;
+	}
 
-		// Compute cost for buckets before split candidate
-		for (int j = 0; j <= i; j++)
-		{
-			bbox0 = BBox::BBoxUnion(bbox0, buckets[j].bbox);
-			count0 += buckets[j].count;
-		}
+	PROFILE_SCOPE("SBVH::BinInParallel");
 
-		// Compute cost for buckets after split candidate
-		for (int j = i + 1; j < NUM_BUCKET; j++)
-		{
-			bbox1 = BBox::BBoxUnion(bbox1, buckets[j].bbox);
-			count1 += buckets[j].count;
-		}
+	size_t numChunks = numCores - numBusy + 1;
+	PrimID chunkSize = (numEntries + numChunks - 1) / numChunks;
+	std::vector<std::vector<BucketInfo>> chunkBuckets(numChunks, std::vector<BucketInfo>(NUM_BUCKET));
+	std::vector<std::thread> threads;
+	for (size_t c = 1; c < numChunks; c++)
+	{
+		PrimID chunkFirst = first + c * chunkSize;
+		PrimID chunkLast = std::min(last, chunkFirst + chunkSize);
+		if (chunkFirst >= chunkLast) break;
 
-		costs[i] = COST_TRAVERSAL + COST_INTERSECTION * (count0 * bbox0.GetSurfaceArea() + count1 * bbox1.GetSurfaceArea()) * invAllGeometriesSA;
+		threads.push_back(std::thread(binFunc, chunkFirst, chunkLast, std::ref(chunkBuckets[c])));
 	}
+	binFunc(first, std::min(last, first + chunkSize), chunkBuckets[0]);
 
-	// Now that we have the costs, we can loop through our buckets and find
-	// which bucket has the lowest cost
-	Cost minCost = costs[0];
-	BucketID minCostBucket = 0;
-	for (int i = 1; i < NUM_BUCKET - 1; i++)
+	for (auto& thread : threads)
 	{
-		if (costs[i] < minCost)
+		thread.join();
+	}
+	busyThreads -= numCores - numBusy;
+
+	for (auto& chunk : chunkBuckets)
+	{
+		for (BucketID b = 0; b < NUM_BUCKET; b++)
 		{
-			minCost = costs[i];
-			minCostBucket = i;
+			buckets[b].count += chunk[b].count;
+			buckets[b].enter += chunk[b].enter;
+			buckets[b].exit += chunk[b].exit;
+			buckets[b].bbox = BBox::BBoxUnion(buckets[b].bbox, chunk[b].bbox);
+			buckets[b].fragments.insert(buckets[b].fragments.end(), chunk[b].fragments.begin(), chunk[b].fragments.end());
 		}
 	}
-
-	return std::tuple<Cost, BucketID>(minCost, minCostBucket);
 }
 
-std::tuple<Cost, BucketID> 
-SBVH::CalculateSpatialSplitCost(
-	Dim dim, 
-	PrimID first, 
-	PrimID last, 
-	std::vector<PrimInfo>& primInfos, 
-	BBox& bboxAllGeoms,
+void
+SBVH::BinObjects(
+	Dim dim,
+	PrimID first,
+	PrimID last,
+	const std::vector<PrimInfo>& primInfos,
+	const BBox& bboxCentroids,
 	std::vector<BucketInfo>& buckets
-	) const {
+	) const
+{
+	// For each primitive in range, determine which bucket it falls into
+	for (PrimID i = first; i < last; i++)
+	{
+		if (primInfos[i].primitiveId == INVALID_ID) continue;
 
-	Cost costs[NUM_BUCKET - 1];
-	float invAllGeometriesSA = 1.0f / bboxAllGeoms.GetSurfaceArea();
-	float bucketSize = (bboxAllGeoms.m_max[dim] - bboxAllGeoms.m_min[dim]) / NUM_BUCKET;
+		int whichBucket = NUM_BUCKET * bboxCentroids.Offset(primInfos.at(i).bbox.m_centroid)[dim];
+		assert(whichBucket <= NUM_BUCKET);
+		if (whichBucket == NUM_BUCKET) whichBucket = NUM_BUCKET - 1;
 
+		buckets[whichBucket].count++;
+		buckets[whichBucket].bbox = BBox::BBoxUnion(buckets[whichBucket].bbox, primInfos.at(i).bbox);
+	}
+}
+
+void
+SBVH::BinSpatial(
+	Dim dim,
+	PrimID first,
+	PrimID last,
+	const std::vector<PrimInfo>& primInfos,
+	const BBox& bboxAllGeoms,
+	std::vector<BucketInfo>& buckets
+	) const
+{
+	float bucketSize = (bboxAllGeoms.m_max[dim] - bboxAllGeoms.m_min[dim]) / NUM_BUCKET;
 
 	// For each primitive in range, determine which bucket it falls into
-	for (int i = first; i < last; i++)
+	for (PrimID i = first; i < last; i++)
 	{
 		if (primInfos[i].primitiveId == INVALID_ID) continue;
 
@@ -330,7 +322,6 @@ SBVH::CalculateSpatialSplitCost(
 				bbox.m_max[dim] = min(bbox.m_max[dim], farSplitPlane);
 				assert(bbox.m_min[dim] <= bbox.m_max[dim]);
 				bbox.m_centroid = BBox::Centroid(bbox.m_min, bbox.m_max);
-				bbox.m_transform = Transform(bbox.m_centroid, glm::vec3(0), bbox.m_max - bbox.m_min);
 #ifdef TIGHT_BBOX
 				vec3 pointOnSplittingPlane = bboxAllGeoms.m_min;
 				for (auto bucket = startEdgeBucket; bucket < endEdgeBucket; bucket++)
@@ -469,9 +460,85 @@ SBVH::CalculateSpatialSplitCost(
 				buckets[b].bbox = BBox::BBoxUnion(buckets[b].bbox, bbox);
 			}
 		} else {
-			buckets[minBucket].bbox = primInfos.at(i).bbox;
+			buckets[minBucket].bbox = BBox::BBoxUnion(buckets[minBucket].bbox, primInfos.at(i).bbox);
 		}
 	}
+}
+
+std::tuple<Cost, BucketID> 
+SBVH::CalculateObjectSplitCost(
+	Dim dim,
+	PrimID first,
+	PrimID last,
+	std::vector<PrimInfo>& primInfos,
+	BBox& bboxCentroids,
+	BBox& bboxAllGeoms
+	) const 
+{
+	std::vector<BucketInfo> buckets(NUM_BUCKET);
+	Cost costs[NUM_BUCKET - 1];
+	float invAllGeometriesSA = 1.0f / bboxAllGeoms.GetSurfaceArea();
+
+	BinInParallel(first, last, buckets, m_numBusyThreads, [&](PrimID chunkFirst, PrimID chunkLast, std::vector<BucketInfo>& chunkBuckets)
+	{
+		BinObjects(dim, chunkFirst, chunkLast, primInfos, bboxCentroids, chunkBuckets);
+	});
+
+	// Compute cost for splitting after each bucket
+	for (int i = 0; i < NUM_BUCKET - 1; i++)
+	{
+		BBox bbox0, bbox1;
+		int count0 = 0, count1 = 0;
+
+		// Compute cost for buckets before split candidate
+		for (int j = 0; j <= i; j++)
+		{
+			bbox0 = BBox::BBoxUnion(bbox0, buckets[j].bbox);
+			count0 += buckets[j].count;
+		}
+
+		// Compute cost for buckets after split candidate
+		for (int j = i + 1; j < NUM_BUCKET; j++)
+		{
+			bbox1 = BBox::BBoxUnion(bbox1, buckets[j].bbox);
+			count1 += buckets[j].count;
+		}
+
+		costs[i] = COST_TRAVERSAL + COST_INTERSECTION * (count0 * bbox0.GetSurfaceArea() + count1 * bbox1.GetSurfaceArea()) * invAllGeometriesSA;
+	}
+
+	// Now that we have the costs, we can loop through our buckets and find
+	// which bucket has the lowest cost
+	Cost minCost = costs[0];
+	BucketID minCostBucket = 0;
+	for (int i = 1; i < NUM_BUCKET - 1; i++)
+	{
+		if (costs[i] < minCost)
+		{
+			minCost = costs[i];
+			minCostBucket = i;
+		}
+	}
+
+	return std::tuple<Cost, BucketID>(minCost, minCostBucket);
+}
+
+std::tuple<Cost, BucketID> 
+SBVH::CalculateSpatialSplitCost(
+	Dim dim, 
+	PrimID first, 
+	PrimID last, 
+	std::vector<PrimInfo>& primInfos, 
+	BBox& bboxAllGeoms,
+	std::vector<BucketInfo>& buckets
+	) const {
+
+	Cost costs[NUM_BUCKET - 1];
+	float invAllGeometriesSA = 1.0f / bboxAllGeoms.GetSurfaceArea();
+	BinInParallel(first, last, buckets, m_numBusyThreads, [&](PrimID chunkFirst, PrimID chunkLast, std::vector<BucketInfo>& chunkBuckets)
+	{
+		BinSpatial(dim, chunkFirst, chunkLast, primInfos, bboxAllGeoms, chunkBuckets);
+	});
 
 	// Compute cost for splitting after each bucket
 	for (int i = 0; i < NUM_BUCKET - 1; i++)
@@ -516,11 +583,11 @@ SBVHNode*
 SBVH::BuildRecursive(
 	PrimID first, 
 	PrimID last,
-	PrimID& nodeCount,
+	std::atomic<PrimID>& nodeCount,
 	std::vector<PrimInfo>& primInfos,
-	std::vector<std::shared_ptr<Geometry>>& orderedGeoms,
 	int depth,
-	bool shouldInsertAtBack
+	bool shouldInsertAtBack,
+	size_t spatialSplitBudget
 	) 
 {
 	if (last <= first || last < 0 || first < 0)
@@ -535,19 +602,22 @@ SBVH::BuildRecursive(
 		bboxAllGeoms = BBox::BBoxUnion(bboxAllGeoms, primInfos[i].bbox);
 	}
 
-	// Num primitive should only reflect unique IDs
+	// Num primitive should only reflect valid entries in this node's range
 	PrimID numPrimitives = 0;
-	for (auto prim : primInfos) {
-		if (prim.primitiveId != INVALID_ID) {
+	for (PrimID i = first; i < last; i++) {
+		if (primInfos[i].primitiveId != INVALID_ID) {
 			++numPrimitives;
-		} else {
-			continue;
 		}
 	}
 	
+	// Only free slots left in this range
+	if (numPrimitives == 0) {
+		return nullptr;
+	}
+
 	// == GENERATE SINGLE GEOMETRY LEAF NODE
 	if (numPrimitives == 1 || depth >= m_maxDepth) {
-		return CreateLeaf(nullptr, first, last, nodeCount, primInfos, orderedGeoms, bboxAllGeoms);
+		return CreateLeaf(nullptr, first, last, nodeCount, primInfos, bboxAllGeoms);
 	}
 
 	// COMPUTE BOUNDS OF ALL CENTROIDS
@@ -564,11 +634,13 @@ SBVH::BuildRecursive(
 	// === GENERATE PLANAR LEAF NODE
 	// If all centroids are the same, create leafe since there's no effective way to split the tree
 	if (bboxCentroids.m_max[dim] == bboxCentroids.m_min[dim]) {
-		return CreateLeaf(nullptr, first, last, nodeCount, primInfos, orderedGeoms, bboxAllGeoms);
+		return CreateLeaf(nullptr, first, last, nodeCount, primInfos, bboxAllGeoms);
 	}
 
 	std::tuple<Cost, BucketID> objSplitCost;
 
+	// Axis the node ends up being split along, used to order traversal
+	Dim splitDim = dim;
 	PrimID mid;
 	switch(m_splitMethod) {
 		case Spatial:
@@ -595,7 +667,7 @@ SBVH::BuildRecursive(
 				bool isSpatialSplit = false;
 				Cost minSplitCost = std::get<Cost>(objSplitCost);
 				std::tuple<Cost, BucketID> spatialSplitCost;
-				if (m_spatialSplitBudget > 0) {
+				if (spatialSplitBudget > 0) {
 					std::vector<BucketInfo> spatialBuckets;
 					spatialBuckets.resize(NUM_BUCKET);
 					spatialSplitCost =
@@ -603,41 +675,33 @@ SBVH::BuildRecursive(
 
 					// Get the cheapest cost between object split candidate and spatial split candidate
 
+					// Consume budget
 					if (minSplitCost > std::get<Cost>(spatialSplitCost))
 					{
+						--spatialSplitBudget;
 						minSplitCost = std::get<Cost>(spatialSplitCost);
 						isSpatialSplit = true;
 
-						// Consume budget
-						m_spatialSplitBudget--;
-
-						std::vector<PrimInfo> origPrims;
+						// Free slot cursors, front is the next slot to try and back is one past it
 						PrimID front = first;
-						PrimID back = last - 1;
+						PrimID back = last;
 						BucketID spatialBucket = std::get<BucketID>(spatialSplitCost);
-						for (auto frag : spatialBuckets[spatialBucket].fragments) {
-							PrimInfo origPrim = primInfos.at(frag.origPrimOffset);
-							origPrims.push_back(origPrim);
-						}
 
-						// Create new fragments
-						PrimID count = 0;
-						for (auto frag : spatialBuckets[std::get<BucketID>(spatialSplitCost)].fragments)
+						// Create new fragments. Each original reference has at most one fragment per bucket,
+						// and fragments only go into free slots, so the originals are still intact here
+						for (const PrimInfo& frag : spatialBuckets[spatialBucket].fragments)
 						{
-							PrimInfo origPrim = origPrims.at(count);
-							count++;
+							const PrimInfo origPrim = primInfos.at(frag.origPrimOffset);
 
 							PrimInfo left = { frag.primitiveId, frag.bbox };
 							left.bbox.m_min[allGeomsDim] = origPrim.bbox.m_min[allGeomsDim];
 							assert(left.bbox.m_min[allGeomsDim] <= left.bbox.m_max[allGeomsDim]);
 							left.bbox.m_centroid = BBox::Centroid(left.bbox.m_min, left.bbox.m_max);
-							left.bbox.m_transform = Transform(left.bbox.m_centroid, glm::vec3(0), left.bbox.m_max - left.bbox.m_min);
 
 							PrimInfo right = { frag.primitiveId, frag.bbox };
 							right.bbox.m_max[allGeomsDim] = origPrim.bbox.m_max[allGeomsDim];
 							assert(right.bbox.m_min[allGeomsDim] <= right.bbox.m_max[allGeomsDim]);
 							right.bbox.m_centroid = BBox::Centroid(right.bbox.m_min, right.bbox.m_max);
-							right.bbox.m_transform = Transform(right.bbox.m_centroid, glm::vec3(0), right.bbox.m_max - right.bbox.m_min);
 
 
 							// Test whether we can unfit this reference if it's overlapping is too small
@@ -651,18 +715,27 @@ SBVH::BuildRecursive(
 								(spatialBuckets[spatialBucket].enter - 1) + BBox::BBoxUnion(right.bbox, origPrim.bbox).GetSurfaceArea() * spatialBuckets[spatialBucket].exit;
 
 							if (csplit < c0 && csplit < c1) {
-								// Insert the new fragments into the priminfos list at both children
-								primInfos.at(frag.origPrimOffset) = left;
+								// Find a free slot for the right fragment, never overwrite a valid reference
+								PrimID freeSlot = INVALID_ID;
 								if (shouldInsertAtBack)
 								{
-									primInfos[back] = right;
-									--back;
+									while (back > first && primInfos[back - 1].primitiveId != INVALID_ID) --back;
+									if (back > first) freeSlot = --back;
 								}
 								else
 								{
-									primInfos[front] = right;
-									++front;
+									while (front < last && primInfos[front].primitiveId != INVALID_ID) ++front;
+									if (front < last) freeSlot = front++;
 								}
+
+								// Out of space in this range, keep the reference whole
+								if (freeSlot == INVALID_ID) {
+									break;
+								}
+
+								// Insert the new fragments into the priminfos list at both children
+								primInfos.at(frag.origPrimOffset) = left;
+								primInfos[freeSlot] = right;
 							} else if (c0 < c1) {
 								
 							} else {
@@ -681,6 +754,7 @@ SBVH::BuildRecursive(
 
 					if (isSpatialSplit) {
 						PartitionSpatial(std::get<BucketID>(spatialSplitCost), allGeomsDim, first, last, mid, primInfos, bboxAllGeoms);
+						splitDim = allGeomsDim;
 						++m_spatialSplitCount;
 
 					} else {
@@ -691,7 +765,7 @@ SBVH::BuildRecursive(
 				{
 					// == CREATE LEAF
 					SBVHLeaf* leaf = CreateLeaf(
-						nullptr, first, last, nodeCount, primInfos, orderedGeoms, bboxAllGeoms
+						nullptr, first, last, nodeCount, primInfos, bboxAllGeoms
 					);
 					return leaf;
 				}
@@ -719,7 +793,7 @@ SBVH::BuildRecursive(
 				{
 					// Cost of splitting buckets is too high, create a leaf node instead
 					SBVHLeaf* leaf = CreateLeaf(
-						nullptr, first, last, nodeCount, primInfos, orderedGeoms, bboxAllGeoms
+						nullptr, first, last, nodeCount, primInfos, bboxAllGeoms
 					);
 					return leaf;
 				}
@@ -732,245 +806,714 @@ SBVH::BuildRecursive(
 			break;
 	}
 
-	// Build near child
-	SBVHNode* nearChild = BuildRecursive(first, mid, nodeCount, primInfos, orderedGeoms, depth + 1, true);
+	// The children share what's left of the budget in proportion to their references. Each subtree only
+	// spends its own share, so the tree doesn't depend on which thread gets to a spatial split first.
+	size_t nearBudget = 0;
+	if (spatialSplitBudget > 0)
+	{
+		size_t numNear = 0;
+		size_t numTotal = 0;
+		for (PrimID i = first; i < last; i++) {
+			if (primInfos[i].primitiveId != INVALID_ID) {
+				numNear += i < mid;
+				++numTotal;
+			}
+		}
+		nearBudget = spatialSplitBudget * numNear / numTotal;
+	}
+	size_t farBudget = spatialSplitBudget - nearBudget;
 
-	// Build far child
-	SBVHNode* farChild = BuildRecursive(mid, last, nodeCount, primInfos, orderedGeoms, depth + 1, false);
+	SBVHNode* nearChild;
+	SBVHNode* farChild;
+	if (numPrimitives >= PARALLEL_BUILD_THRESHOLD && depth < m_maxParallelDepth)
+	{
+		// Children own the disjoint ranges [first, mid) and [mid, last) of primInfos,
+		// so the far child can be built on its own thread without locking
+		m_numBusyThreads++;
+		std::thread farTask([&]()
+		{
+			PROFILE_SCOPE("SBVH::BuildSubtree");
+			farChild = BuildRecursive(mid, last, nodeCount, primInfos, depth + 1, false, farBudget);
+			m_numBusyThreads--;
+		});
+		nearChild = BuildRecursive(first, mid, nodeCount, primInfos, depth + 1, true, nearBudget);
+		farTask.join();
+	}
+	else
+	{
+		// Build near child
+		nearChild = BuildRecursive(first, mid, nodeCount, primInfos, depth + 1, true, nearBudget);
+
+		// Build far child
+		farChild = BuildRecursive(mid, last, nodeCount, primInfos, depth + 1, false, farBudget);
+	}
 
-	SBVHNode* node = new SBVHNode(nullptr, nearChild, farChild, nodeCount, dim);
+	SBVHNode* node = new SBVHNode(nullptr, nearChild, farChild, nodeCount++, splitDim);
 	if (nearChild)
 		nearChild->m_parent = node;
 	if (farChild)
 		farChild->m_parent = node;
-	nodeCount++;
 	return node;
 }
 
 
-Intersection SBVH::GetIntersection(Ray& r) 
+template<typename Policy>
+bool SBVH::Traverse(
+	Ray& r,
+	TriangleBlockHit& hit,
+	const typename Policy::TriangleFilter& filter
+	)
 {
-	float nearestT = INFINITY;
-	Intersection nearestIsx; 
-
-	// Update ray's traversal cost for visual debugging
-	r.m_traversalCost += COST_TRAVERSAL;
-
-	if (m_root->IsLeaf()) {
-		SBVHLeaf* leaf = dynamic_cast<SBVHLeaf*>(m_root);
-		//for (int i = 0; i < leaf->m_numGeoms; i++)
-		//{
-		//	r.m_traversalCost += COST_INTERSECTION;
-		//	
-		//	std::shared_ptr<Geometry> geom = m_geoms[leaf->m_firstGeomOffset + i];
-		//	Intersection isx = geom->GetIntersection(r);
-		//	if (isx.t > 0 && isx.t < nearestT)
-		//	{
-		//		nearestT = isx.t;
-		//		nearestIsx = isx;
-		//	}
-		//}
-		for (auto geomId : leaf->m_geomIds) {
-			r.m_traversalCost += COST_INTERSECTION;
-				
-			std::shared_ptr<Geometry> geom = m_prims[geomId];
-			Intersection isx = geom->GetIntersection(r);
-			if (isx.t > 0 && isx.t < nearestT)
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	TraversalCounters<Policy::Stats> counters;
+	glm::vec3 invDir = 1.0f / r.m_direction;
+	bool dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+	// Nodes still to be visited, in back-to-front order
+	uint32_t toVisit[MAX_TRAVERSAL_DEPTH];
+	int toVisitCount = 0;
+	uint32_t nodeIdx = 0;
+	while (true)
+	{
+		if (Policy::Stats)
+		{
+			// Update ray's traversal cost for visual debugging
+			r.m_traversalCost += COST_TRAVERSAL;
+			counters.numNodesVisited++;
+		}
+
+		const LinearSBVHNode& node = m_nodes[nodeIdx];
+		float tNear, tFar;
+
+		// Skip the node if it's missed, or if it starts beyond the closest hit found so far
+		if (node.m_bounds.DoesIntersect(r.m_origin, invDir, hit.t, tNear, tFar))
+		{
+			if (node.m_isLeaf)
 			{
-				nearestT = isx.t;
-				nearestIsx = isx;
+				for (uint32_t i = 0; i < node.m_numPrims; i++)
+				{
+					const TriangleBlock4& block = m_blocks[node.m_primitivesOffset + i];
+					if (Policy::Stats)
+					{
+						r.m_traversalCost += COST_INTERSECTION * block.m_numGeoms;
+						counters.numTrianglesTested += block.m_numGeoms;
+					}
+
+					if (Policy::AnyHit)
+					{
+						if (block.DoesIntersect(r, hit, filter))
+						{
+							return true;
+						}
+					}
+					else
+					{
+						block.GetIntersection(r, hit, filter);
+					}
+				}
 			}
+			else
+			{
+				// The near child is always stored right after its parent and covers the lower
+				// side of the split. Visit whichever child the ray enters first.
+				assert(toVisitCount < MAX_TRAVERSAL_DEPTH);
+				if (dirIsNeg[node.m_dim])
+				{
+					toVisit[toVisitCount++] = nodeIdx + 1;
+					nodeIdx = node.m_farChildOffset;
+				}
+				else
+				{
+					toVisit[toVisitCount++] = node.m_farChildOffset;
+					nodeIdx = nodeIdx + 1;
+				}
+				continue;
+			}
+		}
 
+		if (toVisitCount == 0)
+		{
+			break;
 		}
-		return nearestIsx;
+		nodeIdx = toVisit[--toVisitCount];
 	}
 
-	// Traverse children
-	GetIntersectionRecursive(r, m_root->m_nearChild, nearestT, nearestIsx);
-	GetIntersectionRecursive(r, m_root->m_farChild, nearestT, nearestIsx);
+	// Any-hit kernels have already returned if anything was hit
+	return !Policy::AnyHit && (hit.triangle != nullptr || hit.isx.hitObject != nullptr);
+}
 
-	return nearestIsx;
+Intersection SBVH::GetIntersection(Ray& r) 
+{
+	return GetIntersection(r, INFINITY);
 }
 
+Intersection SBVH::GetIntersection(
+	Ray& r,
+	float tMax
+	)
+{
+	// Triangle hits are only shaded once traversal has settled on the closest one
+	TriangleBlockHit hit;
+	hit.t = tMax;
+	if (m_recordStats)
+	{
+		Traverse<TraversalPolicy<false, true>>(r, hit, NoTriangleFilter());
+		r.m_traversalCost += hit.traversalCost;
+	}
+	else
+	{
+		Traverse<TraversalPolicy<false, false>>(r, hit, NoTriangleFilter());
+	}
+	return hit.Resolve(r);
+}
 
-void SBVH::GetIntersectionRecursive(
-	Ray& r, 
-	SBVHNode* node, 
-	float& nearestT, 
-	Intersection& nearestIsx
-	) 
+bool SBVH::DoesIntersect(
+	Ray& r,
+	float tMax
+	)
 {
-	// Update ray's traversal cost for visual debugging
-	r.m_traversalCost += COST_TRAVERSAL;
+	TriangleBlockHit hit;
+	hit.t = tMax;
+	if (m_recordStats)
+	{
+		bool isOccluded = Traverse<TraversalPolicy<true, true>>(r, hit, NoTriangleFilter());
+		r.m_traversalCost += hit.traversalCost;
+		return isOccluded;
+	}
+	return Traverse<TraversalPolicy<true, false>>(r, hit, NoTriangleFilter());
+}
 
-	if (node == nullptr) {
-		return;
+bool SBVH::DoesIntersect(
+	Ray& r,
+	float tMax,
+	const TriangleRef& excludeTriangle
+	)
+{
+	TriangleBlockHit hit;
+	hit.t = tMax;
+	ExcludeTriangleFilter filter = { excludeTriangle };
+	if (m_recordStats)
+	{
+		bool isOccluded = Traverse<TraversalPolicy<true, true, ExcludeTriangleFilter>>(r, hit, filter);
+		r.m_traversalCost += hit.traversalCost;
+		return isOccluded;
 	}
+	return Traverse<TraversalPolicy<true, false, ExcludeTriangleFilter>>(r, hit, filter);
+}
 
-	if (node->IsLeaf()) {
-		SBVHLeaf* leaf = dynamic_cast<SBVHLeaf*>(node);
-		if (leaf->m_numGeoms < 4 || node->m_bbox.DoesIntersect(r)) {
-			// Return nearest primitive
-			//for (int i = 0; i < leaf->m_numGeoms; i++)
-			//{
-			//	r.m_traversalCost += COST_INTERSECTION;
-
-			//	std::shared_ptr<Geometry> geom = m_geoms[leaf->m_firstGeomOffset + i];
-			//	Intersection isx = geom->GetIntersection(r);
-			//	if (isx.t > 0 && isx.t < nearestT)
-			//	{
-			//		r.m_traversalCost = COST_INTERSECTION;
-			//		nearestT = isx.t;
-			//		nearestIsx = isx;
-			//	}
-			//}
-			for (auto geomId : leaf->m_geomIds)
-			{
-				r.m_traversalCost += COST_INTERSECTION;
+/**
+ * \brief Slab test of a node against 4 rays of a packet. Lane per lane it computes exactly what
+ * AABB::DoesIntersect does, NaN handling included, so packets never visit a leaf a single ray would skip.
+ * \param tMax : per ray, a negative value never opens the interval
+ * \return bitmask of the rays overlapping the box within [0, tMax]
+ */
+static inline int IntersectBoundsPacket4(
+	const AABB& bounds,
+	const float origins[3][RAY_PACKET_SIZE],
+	const float invDirs[3][RAY_PACKET_SIZE],
+	const float tMax[RAY_PACKET_SIZE],
+	uint32_t firstRay
+	)
+{
+	__m128 tEnter = _mm_setzero_ps();
+	__m128 tExit = _mm_loadu_ps(tMax + firstRay);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		__m128 origin = _mm_loadu_ps(origins[axis] + firstRay);
+		__m128 invDir = _mm_loadu_ps(invDirs[axis] + firstRay);
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.m_min[axis]), origin), invDir);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.m_max[axis]), origin), invDir);
+
+		// Swapped only where t0 > t1, and max/min keep the current bound on NaN, as in the scalar test
+		__m128 swap = _mm_cmpgt_ps(t0, t1);
+		__m128 tNear = _mm_or_ps(_mm_and_ps(swap, t1), _mm_andnot_ps(swap, t0));
+		__m128 tFar = _mm_or_ps(_mm_and_ps(swap, t0), _mm_andnot_ps(swap, t1));
+		tEnter = _mm_max_ps(tNear, tEnter);
+		tExit = _mm_min_ps(tFar, tExit);
+	}
 
-				std::shared_ptr<Geometry> geom = m_prims[geomId];
-				Intersection isx = geom->GetIntersection(r);
-				if (isx.t > 0 && isx.t < nearestT)
-				{
-					nearestT = isx.t;
-					nearestIsx = isx;
-				}
+	return _mm_movemask_ps(_mm_cmple_ps(tEnter, tExit));
+}
+
+template<typename Policy>
+void SBVH::TraversePacket(
+	Ray* rays,
+	uint32_t numRays,
+	TriangleBlockHit* hits,
+	const typename Policy::TriangleFilter* filters,
+	bool* occluded
+	)
+{
+	assert(numRays <= RAY_PACKET_SIZE);
+	if (Policy::AnyHit)
+	{
+		std::fill(occluded, occluded + numRays, false);
+	}
+
+	if (m_nodes.empty() || numRays == 0)
+	{
+		return;
+	}
+
+	// Lanes past numRays stay empty, their interval never opens
+	float origins[3][RAY_PACKET_SIZE] = {};
+	float invDirs[3][RAY_PACKET_SIZE] = {};
+	float tMax[RAY_PACKET_SIZE];
+	std::fill(tMax, tMax + RAY_PACKET_SIZE, -INFINITY);
+	bool dirIsNeg[3];
+	bool isCoherent = true;
+	for (uint32_t i = 0; i < numRays; i++)
+	{
+		glm::vec3 invDir = 1.0f / rays[i].m_direction;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			origins[axis][i] = rays[i].m_origin[axis];
+			invDirs[axis][i] = invDir[axis];
+			bool isNeg = invDir[axis] < 0;
+			isCoherent = isCoherent && (i == 0 || isNeg == dirIsNeg[axis]);
+			dirIsNeg[axis] = isNeg;
+		}
+		tMax[i] = hits[i].t;
+	}
 
+	if (!isCoherent || numRays == 1)
+	{
+		for (uint32_t i = 0; i < numRays; i++)
+		{
+			bool isHit = Traverse<Policy>(rays[i], hits[i], filters[i]);
+			if (Policy::AnyHit)
+			{
+				occluded[i] = isHit;
 			}
 		}
 		return;
 	}
 
-	if (node->m_bbox.DoesIntersect(r))
+	TraversalCounters<Policy::Stats> counters;
+	uint32_t numGroups = (numRays + 3) / 4;
+	uint32_t numActiveRays = numRays;
+
+	// Nodes still to be visited, in back-to-front order
+	uint32_t toVisit[MAX_TRAVERSAL_DEPTH];
+	int toVisitCount = 0;
+	uint32_t nodeIdx = 0;
+	while (true)
 	{
-		// Traverse children
-		GetIntersectionRecursive(r, node->m_nearChild, nearestT, nearestIsx);
-		GetIntersectionRecursive(r, node->m_farChild, nearestT, nearestIsx);
+		const LinearSBVHNode& node = m_nodes[nodeIdx];
+		int rayMask = 0;
+		for (uint32_t group = 0; group < numGroups; group++)
+		{
+			rayMask |= IntersectBoundsPacket4(node.m_bounds, origins, invDirs, tMax, group * 4) << (group * 4);
+		}
+
+		if (Policy::Stats)
+		{
+			counters.numNodesVisited++;
+			for (uint32_t i = 0; i < numRays; i++)
+			{
+				rays[i].m_traversalCost += tMax[i] >= 0 ? COST_TRAVERSAL : 0.0f;
+			}
+		}
+
+		if (rayMask != 0)
+		{
+			if (node.m_isLeaf)
+			{
+				for (uint32_t b = 0; b < node.m_numPrims; b++)
+				{
+					const TriangleBlock4& block = m_blocks[node.m_primitivesOffset + b];
+					for (uint32_t i = 0; i < numRays; i++)
+					{
+						if (!(rayMask & (1 << i))) continue;
+
+						if (Policy::Stats)
+						{
+							rays[i].m_traversalCost += COST_INTERSECTION * block.m_numGeoms;
+							counters.numTrianglesTested += block.m_numGeoms;
+						}
+
+						if (Policy::AnyHit)
+						{
+							if (block.DoesIntersect(rays[i], hits[i], filters[i]))
+							{
+								occluded[i] = true;
+								tMax[i] = -INFINITY;
+								rayMask &= ~(1 << i);
+								if (--numActiveRays == 0)
+								{
+									return;
+								}
+							}
+						}
+						else
+						{
+							block.GetIntersection(rays[i], hits[i], filters[i]);
+							tMax[i] = hits[i].t;
+						}
+					}
+				}
+			}
+			else
+			{
+				// Same visiting order as a single ray, every ray of the packet agrees on it
+				assert(toVisitCount < MAX_TRAVERSAL_DEPTH);
+				if (dirIsNeg[node.m_dim])
+				{
+					toVisit[toVisitCount++] = nodeIdx + 1;
+					nodeIdx = node.m_farChildOffset;
+				}
+				else
+				{
+					toVisit[toVisitCount++] = node.m_farChildOffset;
+					nodeIdx = nodeIdx + 1;
+				}
+				continue;
+			}
+		}
+
+		if (toVisitCount == 0)
+		{
+			break;
+		}
+		nodeIdx = toVisit[--toVisitCount];
 	}
 }
 
-
-bool SBVH::DoesIntersect(
-	Ray& r
+void SBVH::GetIntersectionPacket(
+	Ray* rays,
+	uint32_t numRays,
+	Intersection* isxs
 	)
 {
-	if (m_root->IsLeaf())
+	const NoTriangleFilter filters[RAY_PACKET_SIZE] = {};
+	for (uint32_t first = 0; first < numRays; first += RAY_PACKET_SIZE)
 	{
-		SBVHLeaf* leaf = dynamic_cast<SBVHLeaf*>(m_root);
-		if (leaf->m_numGeoms < 4 || m_root->m_bbox.DoesIntersect(r))
+		uint32_t packetSize = std::min(numRays - first, RAY_PACKET_SIZE);
+		TriangleBlockHit hits[RAY_PACKET_SIZE];
+		if (m_recordStats)
 		{
-			for (auto geomId : leaf->m_geomIds)
+			TraversePacket<TraversalPolicy<false, true>>(rays + first, packetSize, hits, filters, nullptr);
+			for (uint32_t i = 0; i < packetSize; i++)
 			{
-				r.m_traversalCost += COST_INTERSECTION;
+				rays[first + i].m_traversalCost += hits[i].traversalCost;
+			}
+		}
+		else
+		{
+			TraversePacket<TraversalPolicy<false, false>>(rays + first, packetSize, hits, filters, nullptr);
+		}
 
-				std::shared_ptr<Geometry> geom = m_prims[geomId];
-				Intersection isx = geom->GetIntersection(r);
-				if (isx.t > 0)
-				{
-					return true;
-				}
+		for (uint32_t i = 0; i < packetSize; i++)
+		{
+			isxs[first + i] = hits[i].Resolve(rays[first + i]);
+		}
+	}
+}
 
+void SBVH::DoesIntersectPacket(
+	Ray* rays,
+	uint32_t numRays,
+	const float* tMax,
+	const TriangleRef* excludeTriangles,
+	bool* occluded
+	)
+{
+	for (uint32_t first = 0; first < numRays; first += RAY_PACKET_SIZE)
+	{
+		uint32_t packetSize = std::min(numRays - first, RAY_PACKET_SIZE);
+		TriangleBlockHit hits[RAY_PACKET_SIZE];
+		ExcludeTriangleFilter filters[RAY_PACKET_SIZE];
+		for (uint32_t i = 0; i < packetSize; i++)
+		{
+			hits[i].t = tMax[first + i];
+			filters[i].m_exclude = excludeTriangles[first + i];
+		}
+
+		if (m_recordStats)
+		{
+			TraversePacket<TraversalPolicy<true, true, ExcludeTriangleFilter>>(rays + first, packetSize, hits, filters, occluded + first);
+			for (uint32_t i = 0; i < packetSize; i++)
+			{
+				rays[first + i].m_traversalCost += hits[i].traversalCost;
 			}
 		}
-		return false;
+		else
+		{
+			TraversePacket<TraversalPolicy<true, false, ExcludeTriangleFilter>>(rays + first, packetSize, hits, filters, occluded + first);
+		}
 	}
+}
 
-	// Traverse children
-	return DoesIntersectRecursive(r, m_root->m_nearChild) || DoesIntersectRecursive(r, m_root->m_farChild);
+void SBVH::Destroy() {
+	m_nodes.clear();
+	m_blocks.clear();
 }
 
-bool SBVH::DoesIntersectRecursive(
-	Ray& r, 
-	SBVHNode* node
-	)
+size_t SBVH::GetMemoryFootprint() const {
+	return m_nodes.capacity() * sizeof(LinearSBVHNode)
+		+ m_blocks.capacity() * sizeof(TriangleBlock4)
+		+ m_prims.capacity() * sizeof(std::shared_ptr<Geometry>);
+}
+
+std::string SBVH::GetCacheKey() const {
+	std::stringstream key;
+	key << "SBVH maxGeomsInNode=" << m_maxGeomsInNode
+		<< " splitMethod=" << m_splitMethod
+		<< " spatialSplitBudget=" << SPATIAL_SPLIT_BUDGET
+		<< " maxDepth=" << m_maxDepth
+		<< " nodeSize=" << sizeof(LinearSBVHNode)
+		<< " blockSize=" << sizeof(TriangleBlock4);
+	return key.str();
+}
+
+bool SBVH::Serialize(
+	BinaryWriter& out,
+	const std::vector<std::shared_ptr<Geometry>>& geoms
+	) const
 {
-	if (node == nullptr)
+	if (geoms.size() != m_prims.size())
 	{
 		return false;
 	}
 
-	if (node->IsLeaf())
+	std::unordered_map<const Geometry*, uint32_t> geomIndices;
+	for (size_t i = 0; i < geoms.size(); i++)
+	{
+		geomIndices[geoms[i].get()] = static_cast<uint32_t>(i);
+	}
+
+	// Blocks are written as they are, their geometry pointers are replaced on load from the indices
+	std::vector<uint32_t> blockGeoms(m_blocks.size() * TRIANGLE_BLOCK_WIDTH, INVALID_GEOMETRY_INDEX);
+	for (size_t b = 0; b < m_blocks.size(); b++)
 	{
-		SBVHLeaf* leaf = dynamic_cast<SBVHLeaf*>(node);
-		if (leaf->m_numGeoms < 4 || node->m_bbox.DoesIntersect(r))
+		for (int lane = 0; lane < m_blocks[b].m_numGeoms; lane++)
 		{
-			for (auto geomId : leaf->m_geomIds)
+			auto geomIndex = geomIndices.find(m_blocks[b].m_geoms[lane]);
+			if (geomIndex == geomIndices.end())
 			{
-				r.m_traversalCost += COST_INTERSECTION;
-
-				std::shared_ptr<Geometry> geom = m_prims[geomId];
-				Intersection isx = geom->GetIntersection(r);
-				if (isx.t > 0)
-				{
-					return true;
-				}
-
+				return false;
 			}
+			blockGeoms[b * TRIANGLE_BLOCK_WIDTH + lane] = geomIndex->second;
 		}
+	}
+
+	out.WriteArray(m_nodes);
+	out.WriteArray(m_blocks);
+	out.WriteArray(blockGeoms);
+	return true;
+}
+
+bool SBVH::Deserialize(
+	BinaryReader& in,
+	std::vector<std::shared_ptr<Geometry>>& geoms
+	)
+{
+	PROFILE_SCOPE("SBVH::Deserialize");
+	std::vector<uint32_t> blockGeoms;
+	if (!in.ReadArray(m_nodes) || !in.ReadArray(m_blocks) || !in.ReadArray(blockGeoms) ||
+		blockGeoms.size() != m_blocks.size() * TRIANGLE_BLOCK_WIDTH || !HasValidNodes())
+	{
+		Destroy();
 		return false;
 	}
 
-	if (node->m_bbox.DoesIntersect(r))
+	for (size_t b = 0; b < m_blocks.size(); b++)
 	{
-		// Traverse children
-		return DoesIntersectRecursive(r, node->m_nearChild) || DoesIntersectRecursive(r, node->m_farChild);
+		if (m_blocks[b].m_numGeoms > TRIANGLE_BLOCK_WIDTH)
+		{
+			Destroy();
+			return false;
+		}
+
+		for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; lane++)
+		{
+			uint32_t geomIndex = blockGeoms[b * TRIANGLE_BLOCK_WIDTH + lane];
+			if (lane < m_blocks[b].m_numGeoms && geomIndex >= geoms.size())
+			{
+				Destroy();
+				return false;
+			}
+			m_blocks[b].m_geoms[lane] = lane < m_blocks[b].m_numGeoms ? geoms[geomIndex].get() : nullptr;
+		}
 	}
-	return false;
+
+	m_prims = geoms;
+	std::cout << "Number of BVH nodes: " << m_nodes.size() << " (cached)" << std::endl;
+	return true;
 }
 
+bool SBVH::HasValidNodes() const
+{
+	std::vector<int> depths(m_nodes.size(), 0);
+	std::vector<uint8_t> isReferenced(m_nodes.size(), 0);
+	for (size_t i = 0; i < m_nodes.size(); i++)
+	{
+		const LinearSBVHNode& node = m_nodes[i];
+		if (i > 0 && !isReferenced[i])
+		{
+			return false;
+		}
 
+		if (node.m_isLeaf)
+		{
+			if (size_t(node.m_primitivesOffset) + node.m_numPrims > m_blocks.size())
+			{
+				return false;
+			}
+			continue;
+		}
 
-void SBVH::Destroy() {
-	DestroyRecursive(m_root);
+		if (node.m_dim >= 3 || depths[i] + 1 >= MAX_TRAVERSAL_DEPTH)
+		{
+			return false;
+		}
+
+		// Children come after their parent, so every node is checked before traversal could reach it
+		uint32_t children[2] = { static_cast<uint32_t>(i + 1), node.m_farChildOffset };
+		for (uint32_t child : children)
+		{
+			if (child <= i || child >= m_nodes.size() || isReferenced[child])
+			{
+				return false;
+			}
+			isReferenced[child] = 1;
+			depths[child] = depths[i] + 1;
+		}
+	}
+	return true;
 }
 
-void 
-SBVH::DestroyRecursive(SBVHNode* node) {
+uint32_t SBVH::FlattenRecursive(
+	SBVHNode* node,
+	const std::vector<PrimInfo>& primInfos,
+	std::vector<PrimID>& leafPrimIds,
+	std::vector<Geometry*>& leafGeoms
+	)
+{
+	uint32_t nodeIdx = m_nodes.size();
+	m_nodes.push_back(LinearSBVHNode());
 
-	if (node == nullptr) {
-		return;
-	}
+	// A missing child is emitted as an empty leaf so every interior node keeps two children
+	LinearSBVHNode linearNode = {};
+	linearNode.m_bounds = node ? node->m_bbox.GetAABB() : AABB();
 
-	if (node->IsLeaf())
+	if (node == nullptr || node->IsLeaf())
 	{
-		delete node;
-		node = nullptr;
-		return;
+		leafGeoms.clear();
+		if (node)
+		{
+			SBVHLeaf* leaf = static_cast<SBVHLeaf*>(node);
+
+			// Spatial splits can leave several fragments of the same primitive in one leaf, only keep one
+			leafPrimIds.clear();
+			for (size_t i = leaf->m_firstGeomOffset; i < leaf->m_firstGeomOffset + leaf->m_numGeoms; i++)
+			{
+				if (primInfos[i].primitiveId == INVALID_ID) continue;
+				leafPrimIds.push_back(primInfos[i].primitiveId);
+			}
+			std::sort(leafPrimIds.begin(), leafPrimIds.end());
+			leafPrimIds.erase(std::unique(leafPrimIds.begin(), leafPrimIds.end()), leafPrimIds.end());
+
+			for (PrimID primId : leafPrimIds)
+			{
+				leafGeoms.push_back(m_prims[primId].get());
+			}
+		}
+		FlattenLeaf(nodeIdx, linearNode.m_bounds, leafGeoms);
+		return nodeIdx;
 	}
 
-	DestroyRecursive(node->m_nearChild);
-	DestroyRecursive(node->m_farChild);
+	linearNode.m_dim = node->m_dim;
+	FlattenRecursive(node->m_nearChild, primInfos, leafPrimIds, leafGeoms);
+	linearNode.m_farChildOffset = FlattenRecursive(node->m_farChild, primInfos, leafPrimIds, leafGeoms);
 
-	delete node;
-	node == nullptr;
+	m_nodes[nodeIdx] = linearNode;
+	return nodeIdx;
 }
 
-void SBVH::FlattenRecursive(
-	SBVHNode* node
+void SBVH::FlattenLeaf(
+	uint32_t nodeIdx,
+	const AABB& bounds,
+	const std::vector<Geometry*>& geoms
 	)
 {
-	if (node == nullptr)
+	LinearSBVHNode linearNode = {};
+	linearNode.m_bounds = bounds;
+
+	if (geoms.size() <= MAX_LEAF_BLOCKS * TRIANGLE_BLOCK_WIDTH)
 	{
+		linearNode.m_isLeaf = true;
+		linearNode.m_primitivesOffset = m_blocks.size();
+		TriangleBlock4::Pack(geoms, m_blocks);
+
+		size_t numBlocks = m_blocks.size() - linearNode.m_primitivesOffset;
+		if (numBlocks > MAX_LEAF_BLOCKS)
+		{
+			throw std::runtime_error("SBVH leaf has " + std::to_string(numBlocks) + " blocks, more than a node can reference");
+		}
+		linearNode.m_numPrims = static_cast<uint16_t>(numBlocks);
+		m_nodes[nodeIdx] = linearNode;
 		return;
 	}
 
-	m_nodes.push_back(node);
-	FlattenRecursive(node->m_nearChild);
-	FlattenRecursive(node->m_farChild);
+	// Leaves made at the maximum depth or from equal centroids have no size bound. Cut them into sibling
+	// leaves under new interior nodes, splitting on a block boundary so only the last block can be partial.
+	size_t mid = (geoms.size() / 2 + TRIANGLE_BLOCK_WIDTH - 1) / TRIANGLE_BLOCK_WIDTH * TRIANGLE_BLOCK_WIDTH;
+	std::vector<Geometry*> nearGeoms(geoms.begin(), geoms.begin() + mid);
+	std::vector<Geometry*> farGeoms(geoms.begin() + mid, geoms.end());
+	auto boundsOf = [](const std::vector<Geometry*>& range)
+	{
+		BBox bbox;
+		for (Geometry* geom : range)
+		{
+			bbox = BBox::BBoxUnion(bbox, geom->GetBBox());
+		}
+		return bbox.GetAABB();
+	};
+
+	linearNode.m_dim = 0;
+	uint32_t nearIdx = m_nodes.size();
+	m_nodes.push_back(LinearSBVHNode());
+	FlattenLeaf(nearIdx, boundsOf(nearGeoms), nearGeoms);
+	linearNode.m_farChildOffset = m_nodes.size();
+	m_nodes.push_back(LinearSBVHNode());
+	FlattenLeaf(linearNode.m_farChildOffset, boundsOf(farGeoms), farGeoms);
+
+	m_nodes[nodeIdx] = linearNode;
 }
 
-void SBVH::Flatten() {
+void SBVH::Flatten(
+	const std::vector<PrimInfo>& primInfos
+	) {
 
-	FlattenRecursive(m_root);
+	m_nodes.clear();
+	m_blocks.clear();
+	if (m_root)
+	{
+		// Scratch lists reused by every leaf
+		std::vector<PrimID> leafPrimIds;
+		std::vector<Geometry*> leafGeoms;
+		FlattenRecursive(m_root, primInfos, leafPrimIds, leafGeoms);
+	}
 }
 
 void SBVH::GenerateVertices(std::vector<uint16>& indices, std::vector<SWireframe>& vertices)
 {
 	size_t verticeCount = 0;
 	vec3 color;
-	for (auto node : m_nodes)
+	for (const auto& node : m_nodes)
 	{
-		if (node->IsLeaf())
+		// Empty leaves have inverted bounds, nothing to draw
+		if (node.m_bounds.IsEmpty())
+		{
+			continue;
+		}
+
+		if (node.m_isLeaf)
 		{
 			color = vec3(0, 1, 1);
 		}
@@ -979,9 +1522,9 @@ void SBVH::GenerateVertices(std::vector<uint16>& indices, std::vector<SWireframe
 			color = vec3(1, 0, 0);
 		}
 		// Setup vertices
-		glm::vec3 centroid = node->m_bbox.m_centroid;
+		glm::vec3 centroid = BBox::Centroid(node.m_bounds.m_min, node.m_bounds.m_max);
 		glm::vec3 translation = centroid;
-		glm::vec3 scale = glm::vec3(glm::vec3(node->m_bbox.m_max) - glm::vec3(node->m_bbox.m_min));
+		glm::vec3 scale = node.m_bounds.m_max - node.m_bounds.m_min;
 		glm::mat4 transform = glm::translate(glm::mat4(1.0), translation) * glm::scale(glm::mat4(1.0f), scale);
 
 		vertices.push_back(
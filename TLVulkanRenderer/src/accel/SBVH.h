@@ -1,9 +1,10 @@
 #pragma once
 
 #include "AccelStructure.h"
+#include "TriangleBlock.h"
 #include <geometry/BBox.h>
+#include <atomic>
 #include <memory>
-#include <unordered_set>
 
 typedef size_t PrimID;
 typedef size_t SBVHNodeId;
@@ -12,6 +13,11 @@ typedef float Cost;
 
 const PrimID INVALID_ID = std::numeric_limits<size_t>::max();
 const BucketID NUM_BUCKET = 12;
+const int MAX_TRAVERSAL_DEPTH = 64;
+const PrimID PARALLEL_BUILD_THRESHOLD = 4096; // Nodes with fewer primitives build both children on the same thread
+const PrimID PARALLEL_BINNING_THRESHOLD = 65536; // Ranges with fewer entries are binned on a single thread
+const size_t SPATIAL_SPLIT_BUDGET = 20; // Spatial splits allowed in one build
+const size_t MAX_LEAF_BLOCKS = std::numeric_limits<uint16_t>::max(); // LinearSBVHNode::m_numPrims is 16 bit
 
 struct PrimInfo
 {
@@ -97,11 +103,32 @@ public:
 		return true;
 	}
 
+	// Range of primInfos owned by this leaf, free slots included. Leaves never give their range
+	// back, so it stays valid until the tree is flattened.
 	size_t m_firstGeomOffset;
 	size_t m_numGeoms;
-	std::unordered_set<PrimID> m_geomIds;
 };
 
+/**
+ * \brief Compact node used for traversal once the tree is built. Nodes are stored depth-first
+ * in a single array, so the near child of an interior node always follows its parent and only
+ * the far child needs an explicit offset.
+ */
+struct LinearSBVHNode
+{
+	AABB m_bounds;
+	union
+	{
+		uint32_t m_primitivesOffset; // Leaf: first entry in m_blocks
+		uint32_t m_farChildOffset; // Interior: index of the far child
+	};
+	uint16_t m_numPrims; // Leaf: number of blocks
+	uint8_t m_dim;
+	uint8_t m_isLeaf;
+};
+
+static_assert(sizeof(LinearSBVHNode) == 32, "LinearSBVHNode should fit in 32 bytes");
+
 class SBVH : public AccelStructure {
 
 public:
@@ -129,45 +156,98 @@ public:
 
 	void GenerateVertices(std::vector<uint16>& indices, std::vector<SWireframe>& vertices) override;
 	Intersection GetIntersection(Ray& r) override;
-	bool DoesIntersect(Ray& r) override;
+	Intersection GetIntersection(Ray& r, float tMax) override;
+	bool DoesIntersect(Ray& r, float tMax) override;
+	bool DoesIntersect(Ray& r, float tMax, const TriangleRef& excludeTriangle) override;
+	void GetIntersectionPacket(Ray* rays, uint32_t numRays, Intersection* isxs) override;
+	void DoesIntersectPacket(Ray* rays, uint32_t numRays, const float* tMax, const TriangleRef* excludeTriangles, bool* occluded) override;
+
+	size_t GetMemoryFootprint() const override;
 
 	void Destroy() override;
 
-	std::vector<SBVHNode*> m_nodes;
+	std::string GetCacheKey() const override;
+	bool Serialize(BinaryWriter& out, const std::vector<std::shared_ptr<Geometry>>& geoms) const override;
+	bool Deserialize(BinaryReader& in, std::vector<std::shared_ptr<Geometry>>& geoms) override;
+
+	std::vector<LinearSBVHNode> m_nodes;
+
+	// Geometries packed in leaf order, each leaf reads a contiguous range of it. m_prims keeps ownership.
+	std::vector<TriangleBlock4> m_blocks;
 
 protected:
+	/**
+	 * \brief Traversal kernel, compiled once per policy. It's defined in SBVH.cpp, where the virtual queries
+	 * pick the policy.
+	 * \param hit : closest hit so far, hit.t bounds the query
+	 * \return closest-hit: whether anything was hit. Any-hit: true at the first hit.
+	 */
+	template<typename Policy>
+	bool
+	Traverse(
+		Ray& r,
+		TriangleBlockHit& hit,
+		const typename Policy::TriangleFilter& filter
+	);
+
+	/**
+	 * \brief Traverses the tree once for up to RAY_PACKET_SIZE rays. A node is visited while any ray of the
+	 * packet overlaps it, and leaves are only tested by the rays that do, so every ray gets the result it
+	 * would get on its own. Packets whose rays don't agree on the direction signs can't share a visiting
+	 * order and fall back to single ray traversal.
+	 * \param hits : per ray, same meaning as in Traverse
+	 * \param filters : per ray
+	 * \param occluded : any-hit only, per ray
+	 */
+	template<typename Policy>
+	void
+	TraversePacket(
+		Ray* rays,
+		uint32_t numRays,
+		TriangleBlockHit* hits,
+		const typename Policy::TriangleFilter* filters,
+		bool* occluded
+	);
+
 	SBVHNode*
 	BuildRecursive(
 		PrimID first,
 		PrimID last,
-		PrimID& nodeCount,
+		std::atomic<PrimID>& nodeCount,
 		std::vector<PrimInfo>& geomInfos,
-		std::vector<std::shared_ptr<Geometry>>& orderedGeoms,
 		int depth,
-		bool shouldInsertAtBack
+		bool shouldInsertAtBack,
+		size_t spatialSplitBudget // Spatial splits this subtree may still make
 	);
 	
 	void
-	GetIntersectionRecursive(
-		Ray& r, 
-		SBVHNode* node, 
-		float& nearestT, 
-		Intersection& nearestIsx
+	Flatten(const std::vector<PrimInfo>& primInfos);
+
+	uint32_t
+	FlattenRecursive(
+		SBVHNode* node,
+		const std::vector<PrimInfo>& primInfos,
+		std::vector<PrimID>& leafPrimIds,
+		std::vector<Geometry*>& leafGeoms
 	);
 
-	bool 
-	DoesIntersectRecursive(
-		Ray& r,
-		SBVHNode* node);
-
-	void 
-	DestroyRecursive(SBVHNode* node);
-
+	/**
+	 * \brief Writes the leaf holding geoms to m_nodes[nodeIdx]. Leaves with more than MAX_LEAF_BLOCKS blocks
+	 * become a subtree of sibling leaves appended after it.
+	 */
 	void
-	Flatten();
+	FlattenLeaf(
+		uint32_t nodeIdx,
+		const AABB& bounds,
+		const std::vector<Geometry*>& geoms
+	);
 
-	void
-	FlattenRecursive(SBVHNode* node);
+	/**
+	 * \brief Checks that loaded nodes form a tree traversal can't leave: children stored after their parent
+	 * and referenced once, leaves inside m_blocks, and no deeper than the traversal stack
+	 */
+	bool
+	HasValidNodes() const;
 
 	void PartitionEqualCounts(
 		Dim dim,
@@ -204,9 +284,8 @@ protected:
 		SBVHNode* parent,
 		PrimID first,
 		PrimID last,
-		PrimID& nodeCount,
+		std::atomic<PrimID>& nodeCount,
 		std::vector<PrimInfo>& geomInfos,
-		std::vector<std::shared_ptr<Geometry>>& orderedGeoms,
 		BBox& bboxAllGeoms
 		);
 
@@ -215,13 +294,33 @@ protected:
 		SBVHNode* parent,
 		SBVHNode* nearChild,
 		SBVHNode* farChild,
-		PrimID& nodeCount,
+		std::atomic<PrimID>& nodeCount,
 		Dim dim
 		);
 
 	Cost
 	CalculateLeafCost();
 
+	void
+	BinObjects(
+		Dim dim,
+		PrimID first,
+		PrimID last,
+		const std::vector<PrimInfo>& primInfos,
+		const BBox& bboxCentroids,
+		std::vector<BucketInfo>& buckets
+	) const;
+
+	void
+	BinSpatial(
+		Dim dim,
+		PrimID first,
+		PrimID last,
+		const std::vector<PrimInfo>& primInfos,
+		const BBox& bboxAllGeoms,
+		std::vector<BucketInfo>& buckets
+	) const;
+
 	std::tuple<Cost, BucketID>
 	CalculateObjectSplitCost(
 		Dim dim,
@@ -246,8 +345,9 @@ protected:
 	int m_maxGeomsInNode;
 	ESplitMethod m_splitMethod;
 	std::vector<std::shared_ptr<Geometry>> m_prims;
-	unsigned int m_maxDepth = 10;
-	size_t m_spatialSplitBudget = 20;
-	unsigned int m_spatialSplitCount = 0;
+	unsigned int m_maxDepth = 32;
+	unsigned int m_maxParallelDepth = 0;
+	std::atomic<unsigned int> m_spatialSplitCount{ 0 };
+	mutable std::atomic<unsigned int> m_numBusyThreads{ 0 }; // Threads building subtrees or binning, binning only borrows the cores left
 };
 
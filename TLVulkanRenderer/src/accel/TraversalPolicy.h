@@ -0,0 +1,52 @@
+#pragma once
+
+#include <geometry/Geometry.h>
+
+/**
+ * \brief Accepts every triangle hit. Its call folds to a constant, so unfiltered kernels don't pay for the hook.
+ */
+struct NoTriangleFilter
+{
+	bool operator()(const Geometry* triangle, float t, float u, float v) const {
+		return true;
+	}
+
+	// Passed on to geometries holding their own triangles
+	TriangleRef GetExcludedTriangle() const {
+		return TriangleRef();
+	}
+};
+
+/**
+ * \brief Rejects hits on one triangle, typically the one a secondary ray leaves from. A flat triangle can't be
+ * hit again by a ray leaving it, so this only removes false self-intersections. An instanced triangle never
+ * sits in the structure the filter is given to, the instance it was hit through applies the exclusion.
+ */
+struct ExcludeTriangleFilter
+{
+	TriangleRef m_exclude;
+
+	bool operator()(const Geometry* triangle, float t, float u, float v) const {
+		return triangle != m_exclude.triangle;
+	}
+
+	const TriangleRef& GetExcludedTriangle() const {
+		return m_exclude;
+	}
+};
+
+/**
+ * \brief Compile-time description of a traversal kernel. Every combination is instantiated as its own kernel,
+ * so the flags below are resolved by the compiler rather than tested on every node.
+ * \param IsAnyHit : stop at the first hit in (0, tMax) rather than looking for the closest one
+ * \param RecordsStats : update Ray::m_traversalCost for the heat map and the profiler's traversal counters
+ * \param Filter : called on every triangle hit candidate, rejected candidates are skipped. Other geometry
+ * isn't filtered, except for instances which filter the triangles hit through them in occlusion queries.
+ */
+template<bool IsAnyHit, bool RecordsStats, typename Filter = NoTriangleFilter>
+struct TraversalPolicy
+{
+	static const bool AnyHit = IsAnyHit;
+	static const bool Stats = RecordsStats;
+	typedef Filter TriangleFilter;
+};
@@ -0,0 +1,49 @@
+#include "TriangleBlock.h"
+
+void TriangleBlock4::Pack(
+	const std::vector<Geometry*>& geoms,
+	std::vector<TriangleBlock4>& blocks
+	)
+{
+	size_t numLanes = 0;
+
+	auto nextLane = [&](Geometry* geom) -> int
+	{
+		int lane = numLanes % TRIANGLE_BLOCK_WIDTH;
+		if (lane == 0)
+		{
+			TriangleBlock4 block = {};
+			blocks.push_back(block);
+		}
+		blocks.back().m_geoms[lane] = geom;
+		blocks.back().m_numGeoms++;
+		numLanes++;
+		return lane;
+	};
+
+	for (Geometry* geom : geoms)
+	{
+		Triangle* tri = dynamic_cast<Triangle*>(geom);
+		if (tri == nullptr) continue;
+
+		int lane = nextLane(geom);
+		TriangleBlock4& block = blocks.back();
+		glm::vec3 edge1 = tri->vert1 - tri->vert0;
+		glm::vec3 edge2 = tri->vert2 - tri->vert0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			block.m_v0[axis][lane] = tri->vert0[axis];
+			block.m_edge1[axis][lane] = edge1[axis];
+			block.m_edge2[axis][lane] = edge2[axis];
+		}
+		block.m_triangleMask |= 1 << lane;
+	}
+
+	for (Geometry* geom : geoms)
+	{
+		if (dynamic_cast<Triangle*>(geom) != nullptr) continue;
+
+		int lane = nextLane(geom);
+		blocks.back().m_geometryMask |= 1 << lane;
+	}
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <geometry/Geometry.h>
+#include "TraversalPolicy.h"
+#include <xmmintrin.h>
+#include <cstdint>
+
+const int TRIANGLE_BLOCK_WIDTH = 4;
+
+/**
+ * \brief Closest hit found while testing triangle blocks. Triangle hits only keep t/u/v so shading
+ * can be resolved once for the final hit, other geometry already comes with a full intersection.
+ */
+struct TriangleBlockHit
+{
+	TriangleBlockHit() : t(INFINITY), u(0), v(0), triangle(nullptr), traversalCost(0) {}
+
+	float t;
+	float u;
+	float v;
+	Triangle* triangle; // Set when the closest hit so far is a triangle
+	Intersection isx; // Set when the closest hit so far came from another geometry
+	float traversalCost; // Reported by the geometries tested, see GeometryQuery
+
+	Intersection Resolve(const Ray& r) const {
+		return triangle ? triangle->GetShadingIntersection(r, t, u, v) : isx;
+	}
+};
+
+/**
+ * \brief SoA pack of up to 4 geometries from one leaf. Triangle lanes store vertex 0 and the two edges
+ * sharing it, and are tested together with SSE. Any other geometry sitting in a lane is flagged in
+ * m_geometryMask and goes through the virtual Geometry::GetIntersection instead.
+ */
+struct TriangleBlock4
+{
+	float m_v0[3][TRIANGLE_BLOCK_WIDTH];
+	float m_edge1[3][TRIANGLE_BLOCK_WIDTH];
+	float m_edge2[3][TRIANGLE_BLOCK_WIDTH];
+	Geometry* m_geoms[TRIANGLE_BLOCK_WIDTH];
+	uint8_t m_triangleMask; // Lanes holding triangles
+	uint8_t m_geometryMask; // Lanes holding other geometry
+	uint8_t m_numGeoms;
+
+	/**
+	* \brief Packs geometries into blocks, triangles first so they share as few blocks as possible
+	*/
+	static void Pack(const std::vector<Geometry*>& geoms, std::vector<TriangleBlock4>& blocks);
+
+	/**
+	* \brief 4-wide Moller-Trumbore against the triangle lanes
+	* \param tMax : only hits in (0, tMax) are reported
+	* \param t, u, v : distance and barycentric coordinates of the closest hit
+	* \param filter : hits it rejects are skipped, the next closest lane is tried instead
+	* \return lane of the closest hit, -1 if no lane was hit
+	*/
+	template<typename TriangleFilter = NoTriangleFilter>
+	inline int IntersectTriangles(
+		const glm::vec3& origin,
+		const glm::vec3& dir,
+		float tMax,
+		float& t,
+		float& u,
+		float& v,
+		const TriangleFilter& filter = TriangleFilter()
+	) const;
+
+	/**
+	* \brief Tests every lane and updates hit if anything closer than hit.t is found
+	*/
+	template<typename TriangleFilter = NoTriangleFilter>
+	inline void GetIntersection(
+		const Ray& r,
+		TriangleBlockHit& hit,
+		const TriangleFilter& filter = TriangleFilter()
+	) const;
+
+	/**
+	* \brief Occlusion test, true as soon as any lane is hit in (0, hit.t). Only hit.traversalCost is updated.
+	*/
+	template<typename TriangleFilter = NoTriangleFilter>
+	inline bool DoesIntersect(
+		const Ray& r,
+		TriangleBlockHit& hit,
+		const TriangleFilter& filter = TriangleFilter()
+	) const;
+};
+
+template<typename TriangleFilter>
+int TriangleBlock4::IntersectTriangles(
+	const glm::vec3& origin,
+	const glm::vec3& dir,
+	float tMax,
+	float& t,
+	float& u,
+	float& v,
+	const TriangleFilter& filter
+	) const
+{
+	if (m_triangleMask == 0)
+	{
+		return -1;
+	}
+
+	const __m128 dx = _mm_set1_ps(dir.x);
+	const __m128 dy = _mm_set1_ps(dir.y);
+	const __m128 dz = _mm_set1_ps(dir.z);
+
+	const __m128 e1x = _mm_loadu_ps(m_edge1[0]);
+	const __m128 e1y = _mm_loadu_ps(m_edge1[1]);
+	const __m128 e1z = _mm_loadu_ps(m_edge1[2]);
+	const __m128 e2x = _mm_loadu_ps(m_edge2[0]);
+	const __m128 e2y = _mm_loadu_ps(m_edge2[1]);
+	const __m128 e2z = _mm_loadu_ps(m_edge2[2]);
+
+	// pvec = cross(dir, edge2), det = dot(pvec, edge1)
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, e1x), _mm_mul_ps(py, e1y)), _mm_mul_ps(pz, e1z));
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// tvec = origin - vert0
+	const __m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(m_v0[0]));
+	const __m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(m_v0[1]));
+	const __m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(m_v0[2]));
+	const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, tx), _mm_mul_ps(py, ty)), _mm_mul_ps(pz, tz)), invDet);
+
+	// qvec = cross(tvec, edge1)
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(e1y, tz));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(e1z, tx));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(e1x, ty));
+	const __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	// Same rejection rules as Triangle::GetIntersection, plus the (0, tMax) range
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 hit = _mm_cmpge_ps(absDet, _mm_set1_ps(EPSILON));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(uu, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(uu, one));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(vv, zero));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(uu, vv), one));
+	hit = _mm_and_ps(hit, _mm_cmpgt_ps(tt, zero));
+	hit = _mm_and_ps(hit, _mm_cmplt_ps(tt, _mm_set1_ps(tMax)));
+
+	int hitMask = _mm_movemask_ps(hit) & m_triangleMask;
+	if (hitMask == 0)
+	{
+		return -1;
+	}
+
+	float ts[TRIANGLE_BLOCK_WIDTH], us[TRIANGLE_BLOCK_WIDTH], vs[TRIANGLE_BLOCK_WIDTH];
+	_mm_storeu_ps(ts, tt);
+	_mm_storeu_ps(us, uu);
+	_mm_storeu_ps(vs, vv);
+
+	// Unfiltered, the first candidate is always accepted and this runs once
+	while (hitMask != 0)
+	{
+		int nearestLane = -1;
+		for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; lane++)
+		{
+			if ((hitMask & (1 << lane)) && (nearestLane < 0 || ts[lane] < ts[nearestLane]))
+			{
+				nearestLane = lane;
+			}
+		}
+
+		if (filter(m_geoms[nearestLane], ts[nearestLane], us[nearestLane], vs[nearestLane]))
+		{
+			t = ts[nearestLane];
+			u = us[nearestLane];
+			v = vs[nearestLane];
+			return nearestLane;
+		}
+		hitMask &= ~(1 << nearestLane);
+	}
+
+	return -1;
+}
+
+template<typename TriangleFilter>
+void TriangleBlock4::GetIntersection(
+	const Ray& r,
+	TriangleBlockHit& hit,
+	const TriangleFilter& filter
+	) const
+{
+	float t, u, v;
+	int lane = IntersectTriangles(r.m_origin, r.m_direction, hit.t, t, u, v, filter);
+	if (lane >= 0)
+	{
+		hit.t = t;
+		hit.u = u;
+		hit.v = v;
+		hit.triangle = static_cast<Triangle*>(m_geoms[lane]);
+	}
+
+	for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; lane++)
+	{
+		if (!(m_geometryMask & (1 << lane))) continue;
+
+		GeometryQuery query(hit.t, filter.GetExcludedTriangle());
+		Intersection isx = m_geoms[lane]->GetIntersection(r, query);
+		hit.traversalCost += query.traversalCost;
+		if (isx.t > 0 && isx.t < hit.t)
+		{
+			hit.t = isx.t;
+			hit.isx = isx;
+			hit.triangle = nullptr;
+		}
+	}
+}
+
+template<typename TriangleFilter>
+bool TriangleBlock4::DoesIntersect(
+	const Ray& r,
+	TriangleBlockHit& hit,
+	const TriangleFilter& filter
+	) const
+{
+	float t, u, v;
+	if (IntersectTriangles(r.m_origin, r.m_direction, hit.t, t, u, v, filter) >= 0)
+	{
+		return true;
+	}
+
+	for (int lane = 0; lane < TRIANGLE_BLOCK_WIDTH; lane++)
+	{
+		if (!(m_geometryMask & (1 << lane))) continue;
+
+		GeometryQuery query(hit.t, filter.GetExcludedTriangle());
+		bool isOccluded = m_geoms[lane]->DoesIntersect(r, query);
+		hit.traversalCost += query.traversalCost;
+		if (isOccluded)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <utility>
+
+/**
+ * \brief Slim axis-aligned bounding box used by the acceleration structures.
+ * Only stores the two corners so it packs tightly into traversal nodes.
+ */
+struct AABB
+{
+	glm::vec3 m_min;
+	glm::vec3 m_max;
+
+	AABB() :
+		m_min(INFINITY, INFINITY, INFINITY),
+		m_max(-INFINITY, -INFINITY, -INFINITY)
+	{}
+
+	AABB(const glm::vec3& min, const glm::vec3& max) :
+		m_min(min),
+		m_max(max)
+	{}
+
+	bool IsEmpty() const {
+		return m_min.x > m_max.x || m_min.y > m_max.y || m_min.z > m_max.z;
+	}
+
+	float GetSurfaceArea() const {
+		glm::vec3 scale = m_max - m_min;
+		return 2.0f * (scale.x * scale.y + scale.x * scale.z + scale.y * scale.z);
+	}
+
+	/**
+	* \brief Slab test against the box
+	* \param origin : ray origin
+	* \param invDir : reciprocal of the ray direction, precomputed once per ray
+	* \param tMax : hits entering the box beyond this distance are rejected
+	* \param tNear : entry distance along the ray, clamped to 0
+	* \param tFar : exit distance along the ray, clamped to tMax
+	* \return whether the ray overlaps the box within [0, tMax]
+	*/
+	inline bool DoesIntersect(
+		const glm::vec3& origin,
+		const glm::vec3& invDir,
+		float tMax,
+		float& tNear,
+		float& tFar
+	) const {
+		tNear = 0;
+		tFar = tMax;
+		for (int i = 0; i < 3; i++)
+		{
+			float t0 = (m_min[i] - origin[i]) * invDir[i];
+			float t1 = (m_max[i] - origin[i]) * invDir[i];
+			if (t0 > t1)
+			{
+				std::swap(t0, t1);
+			}
+
+			// Written so that a NaN (ray parallel to and lying on a slab) leaves the interval untouched
+			tNear = t0 > tNear ? t0 : tNear;
+			tFar = t1 < tFar ? t1 : tFar;
+			if (tNear > tFar)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+static_assert(sizeof(AABB) == 24, "AABB should only hold its two corners");
@@ -1,56 +1,16 @@
 #include "bbox.h"
-#include <glm/gtc/matrix_inverse.hpp>
 
 
 bool BBox::DoesIntersect(const Ray& r) const 
 {
-	//Transform the ray
-	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
-
-	// If ray origin is inside cube, return true
-	bool isInside = true;
-	for (int i = 0; i < 3; i++) {
-		isInside &= (r_loc.m_origin[i] < 0.5f && r_loc.m_origin[i] > -0.5f);
-	}
-
-	if (isInside) return true;
-
-	float t_n = -1000000;
-	float t_f = 1000000;
-	for (int i = 0; i < 3; i++)
-	{
-		//Ray parallel to slab check
-		if (r_loc.m_direction[i] == 0)
-		{
-			if (r_loc.m_origin[i] < -0.5f || r_loc.m_origin[i] > 0.5f)
-			{
-				return false;
-			}
-		}
-		//If not parallel, do slab intersect check
-		float t0 = (-0.5f - r_loc.m_origin[i]) / r_loc.m_direction[i];
-		float t1 = (0.5f - r_loc.m_origin[i]) / r_loc.m_direction[i];
-		if (t0 > t1)
-		{
-			float temp = t1;
-			t1 = t0;
-			t0 = temp;
-		}
-		if (t0 > t_n)
-		{
-			t_n = t0;
-		}
-		if (t1 < t_f)
-		{
-			t_f = t1;
-		}
-	}
-	if (t_n < t_f)// && t_n >= 0)
-	{
-		return true;
-	}
+	float tNear, tFar;
+	return DoesIntersect(r, tNear, tFar);
+}
 
-	return false;
+bool BBox::DoesIntersect(const Ray& r, float& tNear, float& tFar) const
+{
+	glm::vec3 invDir = 1.0f / r.m_direction;
+	return GetAABB().DoesIntersect(r.m_origin, invDir, INFINITY, tNear, tFar);
 }
 
 glm::vec3 BBox::Offset(const glm::vec3& point) const 
@@ -62,15 +22,9 @@ glm::vec3 BBox::Offset(const glm::vec3& point) const
 	return out; 
 }
 
-float BBox::GetSurfaceArea() {
-
-	// @todo: careful if we need to dynamically update bbox
-	//if (m_area < 0 || m_isDirty) {
-		vec3 scale = m_max - m_min;
-		m_area = 2.0f * (scale.x * scale.y + scale.x * scale.z + scale.y * scale.z);
-	//}
-
-	return m_area;
+float BBox::GetSurfaceArea() const {
+	vec3 scale = m_max - m_min;
+	return 2.0f * (scale.x * scale.y + scale.x * scale.z + scale.y * scale.z);
 }
 
 
@@ -101,8 +55,6 @@ BBox BBox::BBoxUnion(const BBox& a, const BBox& b) {
 	ret.m_min.y = glm::min(a.m_min.y, b.m_min.y);
 	ret.m_min.z = glm::min(a.m_min.z, b.m_min.z);
 	ret.m_centroid = BBox::Centroid(ret.m_max, ret.m_min);
-	ret.m_transform = Transform(ret.m_centroid, glm::vec3(0), ret.m_max - ret.m_min);
-	ret.m_isDirty = false;
 	return ret;
 }
 
@@ -116,8 +68,6 @@ BBox BBox::BBoxUnion(const BBox& a, const vec3& point)
 	ret.m_min.y = glm::min(a.m_min.y, point.y);
 	ret.m_min.z = glm::min(a.m_min.z, point.z);
 	ret.m_centroid = BBox::Centroid(ret.m_max, ret.m_min);
-	ret.m_transform = Transform(ret.m_centroid, glm::vec3(0), ret.m_max - ret.m_min);
-	ret.m_isDirty = false;
 	return ret;
 }
 
@@ -131,8 +81,6 @@ BBox BBox::BBoxOverlap(const BBox& a, const BBox& b)
 	ret.m_min.y = glm::max(glm::min(a.m_max.x, b.m_min.x), glm::min(a.m_min.x, b.m_max.x));
 	ret.m_min.z = glm::max(glm::min(a.m_max.x, b.m_min.x), glm::min(a.m_min.x, b.m_max.x));
 	ret.m_centroid = BBox::Centroid(ret.m_max, ret.m_min);
-	ret.m_transform = Transform(ret.m_centroid, glm::vec3(0), ret.m_max - ret.m_min);
-	ret.m_isDirty = false;
 	return ret;
 }
 
@@ -149,8 +97,6 @@ BBox BBox::BBoxFromPoints(std::vector<vec3>& points)
 		ret.m_min.z = glm::min(ret.m_min.z, point.z);
 	}
 	ret.m_centroid = BBox::Centroid(ret.m_max, ret.m_min);
-	ret.m_transform = Transform(ret.m_centroid, glm::vec3(0), ret.m_max - ret.m_min);
-	ret.m_isDirty = false;
 
 	return ret;
 }
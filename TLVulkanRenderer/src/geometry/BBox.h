@@ -2,6 +2,7 @@
 
 #include "glm/glm.hpp"
 #include <geometry/Geometry.h>
+#include <geometry/AABB.h>
 #include <memory>
 
 typedef unsigned int Dim;
@@ -18,22 +19,30 @@ public:
 	glm::vec3 m_min;
 	glm::vec3 m_max;
 	glm::vec3 m_centroid;
-	Transform m_transform;
-	float m_area;
-	bool m_isDirty;
 
 	BBox() : 
 		m_min(INFINITY, INFINITY, INFINITY), 
 		m_max(-INFINITY, -INFINITY, -INFINITY), 
-		m_centroid(vec3(0, 0, 0)),
-		m_transform(Transform()),
-		m_area(-1),
-		m_isDirty(false)
+		m_centroid(vec3(0, 0, 0))
 	{}
 
 	bool DoesIntersect(const Ray& r) const;
+
+	/**
+	* \brief Slab test directly against m_min/m_max
+	* \param r : ray in world space
+	* \param tNear : entry distance along the ray
+	* \param tFar : exit distance along the ray
+	* \return whether the ray hits the box in front of its origin
+	*/
+	bool DoesIntersect(const Ray& r, float& tNear, float& tFar) const;
+
 	glm::vec3 Offset(const glm::vec3& point) const;
-	float GetSurfaceArea();
+	float GetSurfaceArea() const;
+
+	AABB GetAABB() const {
+		return AABB(m_min, m_max);
+	}
 
 	bool IsInside(const vec3& point) const;
 
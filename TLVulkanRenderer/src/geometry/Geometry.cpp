@@ -18,24 +18,42 @@ BBox SquarePlane::GetBBox()
 	return BBox();
 }
 
-Intersection Sphere::GetIntersection(const Ray& r) {
-	//Transform the ray
-	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
-	Intersection result;
-
+bool Sphere::GetLocalIntersection(const Ray& r_loc, float& t) const {
 	float A = pow(r_loc.m_direction[0], 2) + pow(r_loc.m_direction[1], 2) + pow(r_loc.m_direction[2], 2);
 	float B = 2 * (r_loc.m_direction[0] * r_loc.m_origin[0] + r_loc.m_direction[1] * r_loc.m_origin[1] + r_loc.m_direction[2] * r_loc.m_origin[2]);
 	float C = pow(r_loc.m_origin[0], 2) + pow(r_loc.m_origin[1], 2) + pow(r_loc.m_origin[2], 2) - 0.25f;//Radius is 0.5f
 	float discriminant = B * B - 4 * A * C;
 	//If the discriminant is negative, then there is no real root
 	if (discriminant < 0) {
-		return result;
+		return false;
 	}
-	float t = (-B - sqrt(discriminant)) / (2 * A);
+	t = (-B - sqrt(discriminant)) / (2 * A);
 	if (t < 0) {
 		t = (-B + sqrt(discriminant)) / (2 * A);
 	}
-	if (t >= 0) {
+	return t >= 0;
+}
+
+bool Sphere::DoesIntersect(const Ray& r, float tMax) {
+	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
+	float t;
+	if (!GetLocalIntersection(r_loc, t)) {
+		return false;
+	}
+
+	// Same world space distance as GetIntersection, minus the shading attributes
+	glm::vec3 hitPoint = glm::vec3(m_transform.T() * glm::vec4(r_loc.m_origin + t * r_loc.m_direction, 1));
+	float tWorld = glm::distance(hitPoint, r.m_origin);
+	return tWorld > 0 && tWorld < tMax;
+}
+
+Intersection Sphere::GetIntersection(const Ray& r) {
+	//Transform the ray
+	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
+	Intersection result;
+
+	float t;
+	if (GetLocalIntersection(r_loc, t)) {
 		glm::vec4 P = glm::vec4(r_loc.m_origin + t * r_loc.m_direction, 1);
 		result.hitPoint = glm::vec3(m_transform.T() * P);
 		glm::vec3 normal = glm::vec3(P);
@@ -73,24 +91,18 @@ BBox Sphere::GetBBox() {
 	bbox.m_min = glm::min(p0, glm::min(p1, glm::min(p2, glm::min(p3, glm::min(p4, glm::min(p5, glm::min(p6, p7)))))));
 	bbox.m_max = glm::max(p0, glm::max(p1, glm::max(p2, glm::max(p3, glm::max(p4, glm::max(p5, glm::max(p6, p7)))))));
 	bbox.m_centroid = BBox::Centroid(bbox.m_min, bbox.m_max);
-	bbox.m_transform = Transform(bbox.m_centroid, glm::vec3(0), bbox.m_max - bbox.m_min);
-	bbox.m_isDirty = false;
 
 	return bbox;
 }
 
-Intersection Cube::GetIntersection(const Ray& r) {
-	//Transform the ray
-	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
-	Intersection result;
-
+bool Cube::GetLocalIntersection(const Ray& r_loc, float& t) const {
 	float t_n = -1000000;
 	float t_f = 1000000;
 	for (int i = 0; i < 3; i++) {
 		//Ray parallel to slab check
 		if (r_loc.m_direction[i] == 0) {
 			if (r_loc.m_origin[i] < -0.5f || r_loc.m_origin[i] > 0.5f) {
-				return result;
+				return false;
 			}
 		}
 		//If not parallel, do slab intersect check
@@ -108,7 +120,31 @@ Intersection Cube::GetIntersection(const Ray& r) {
 			t_f = t1;
 		}
 	}
-	if (t_n < t_f && t_n >= 0) {
+	//If t_near was greater than t_far, we did not hit the cube
+	t = t_n;
+	return t_n < t_f && t_n >= 0;
+}
+
+bool Cube::DoesIntersect(const Ray& r, float tMax) {
+	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
+	float t_n;
+	if (!GetLocalIntersection(r_loc, t_n)) {
+		return false;
+	}
+
+	// Same world space distance as GetIntersection, minus the shading attributes
+	glm::vec3 hitPoint = glm::vec3(m_transform.T() * glm::vec4(r_loc.m_origin + t_n * r_loc.m_direction, 1));
+	float tWorld = glm::distance(hitPoint, r.m_origin);
+	return tWorld > 0 && tWorld < tMax;
+}
+
+Intersection Cube::GetIntersection(const Ray& r) {
+	//Transform the ray
+	Ray r_loc = r.GetTransformedCopy(m_transform.invT());
+	Intersection result;
+
+	float t_n;
+	if (GetLocalIntersection(r_loc, t_n)) {
 		//Lastly, transform the point found in object space by T
 		glm::vec4 P = glm::vec4(r_loc.m_origin + t_n * r_loc.m_direction, 1);
 		result.hitPoint = glm::vec3(m_transform.T() * P);
@@ -118,11 +154,8 @@ Intersection Cube::GetIntersection(const Ray& r) {
 		result.hitObject = this;
 		result.t = glm::distance(result.hitPoint, r.m_origin);
 		result.hitTextureColor = m_material->m_colorDiffuse;
-		return result;
-	}
-	else {//If t_near was greater than t_far, we did not hit the cube
-		return result;
 	}
+	return result;
 }
 
 BBox Cube::GetBBox() {
@@ -141,18 +174,13 @@ BBox Cube::GetBBox() {
 	bbox.m_min = glm::min(p0, glm::min(p1, glm::min(p2, glm::min(p3, glm::min(p4, glm::min(p5, glm::min(p6, p7)))))));
 	bbox.m_max = glm::max(p0, glm::max(p1, glm::max(p2, glm::max(p3, glm::max(p4, glm::max(p5, glm::max(p6, p7)))))));
 	bbox.m_centroid = BBox::Centroid(bbox.m_min, bbox.m_max);
-	bbox.m_transform = Transform(bbox.m_centroid, glm::vec3(0), bbox.m_max - bbox.m_min);
-	bbox.m_isDirty = false;
 	return bbox;
 }
 
-Intersection Triangle::GetIntersection(const Ray& r) {
-	Intersection isx;
+bool Triangle::GetBarycentricIntersection(const Ray& r, float& t, float& u, float& v) const {
 	// Compute fast intersection using Muller and Trumbore, this skips computing the plane's equation.
 	// See https://www.cs.virginia.edu/~gfx/Courses/2003/ImageSynthesis/papers/Acceleration/Fast%20MinimumStorage%20RayTriangle%20Intersection.pdf
 
-	float t = -1.0;
-
 	// Find the edges that share vertice 0
 	vec3 edge1 = vert1 - vert0;
 	vec3 edge2 = vert2 - vert0;
@@ -162,31 +190,50 @@ Intersection Triangle::GetIntersection(const Ray& r) {
 	// If determinant is 0, ray lies in plane of triangle
 	float det = dot(pvec, edge1);
 	if (fabs(det) < EPSILON) {
-		return Intersection();
+		return false;
 	}
 	float inv_det = 1.0f / det;
 	vec3 tvec = r.m_origin - vert0;
 
 	// u, v are the barycentric coordinates of the intersection point in the triangle
 	// t is the distance between the ray's origin and the point of intersection
-	float u, v;
 
 	// Compute u
 	u = dot(pvec, tvec) * inv_det;
 	if (u < 0.0 || u > 1.0) {
-		return Intersection();
+		return false;
 	}
 
 	// Compute v
 	vec3 qvec = cross(tvec, edge1);
 	v = dot(r.m_direction, qvec) * inv_det;
 	if (v < 0.0 || (u + v) > 1.0) {
-		return Intersection();
+		return false;
 	}
 
 	// Compute t
 	t = dot(edge2, qvec) * inv_det;
 
+	return true;
+}
+
+Intersection Triangle::GetIntersection(const Ray& r) {
+	float t, u, v;
+	if (!GetBarycentricIntersection(r, t, u, v)) {
+		return Intersection();
+	}
+
+	return GetShadingIntersection(r, t, u, v);
+}
+
+bool Triangle::DoesIntersect(const Ray& r, float tMax) {
+	float t, u, v;
+	return GetBarycentricIntersection(r, t, u, v) && t > 0 && t < tMax;
+}
+
+Intersection Triangle::GetShadingIntersection(const Ray& r, float t, float u, float v) {
+	Intersection isx;
+
 	// Color
 	glm::vec2 uv = uv0 * (1 - u - v) + uv1 * u + uv2 * v;
 
@@ -214,8 +261,6 @@ BBox Triangle::GetBBox() {
 	box.m_max.y = max(p0.y, max(p1.y, p2.y));
 	box.m_max.z = max(p0.z, max(p1.z, p2.z));
 	box.m_centroid = BBox::Centroid(box.m_min, box.m_max);
-	box.m_transform = Transform(box.m_centroid, glm::vec3(0), box.m_max - box.m_min);
-	box.m_isDirty = false;
 
 	return box;
 }
@@ -20,7 +20,36 @@ public:
 	ColorRGB hitTextureColor;
 	float t;
 	Geometry* hitObject;
-	Intersection() : t(-1), hitObject(nullptr) {};
+	const Geometry* hitInstance; // Instance hitObject was hit through, nullptr for geometry placed directly
+	Intersection() : t(-1), hitObject(nullptr), hitInstance(nullptr) {};
+};
+
+/**
+ * \brief Identifies a triangle a secondary ray leaves from. Instanced triangles are shared by every instance
+ * of their mesh, so they are told apart by the instance they were hit through.
+ */
+struct TriangleRef
+{
+	TriangleRef() : triangle(nullptr), instance(nullptr) {}
+	TriangleRef(const Geometry* triangle, const Geometry* instance) : triangle(triangle), instance(instance) {}
+
+	const Geometry* triangle;
+	const Geometry* instance; // nullptr for triangles placed directly in the scene
+};
+
+/**
+ * \brief What a traversal hands down to the geometries in its leaves, and what they report back. Only
+ * geometries with a structure of their own, like instances, make use of it.
+ */
+struct GeometryQuery
+{
+	GeometryQuery(float tMax, const TriangleRef& excludeTriangle) :
+		tMax(tMax), excludeTriangle(excludeTriangle), traversalCost(0)
+	{}
+
+	float tMax; // Hits at or beyond it are of no interest
+	TriangleRef excludeTriangle; // Occlusion queries ignore hits on it
+	float traversalCost; // Added to by the geometry's own traversal, for the ray cost heat map
 };
 
 class Geometry
@@ -30,6 +59,32 @@ public:
 	virtual ~Geometry();
 
 	virtual Intersection GetIntersection(const Ray& r) = 0;
+
+	/**
+	* \brief Occlusion test, only reports whether something is hit in (0, tMax) without any shading work.
+	* Geometries that can cheaply skip their shading attributes should override it.
+	*/
+	virtual bool DoesIntersect(const Ray& r, float tMax) {
+		Intersection isx = GetIntersection(r);
+		return isx.t > 0 && isx.t < tMax;
+	}
+
+	/**
+	* \brief Closest hit in (0, query.tMax), for a traversal that already has a hit at query.tMax. Geometries
+	* with a structure of their own override it to skip what lies beyond, the others run the plain query.
+	*/
+	virtual Intersection GetIntersection(const Ray& r, GeometryQuery& query) {
+		return GetIntersection(r);
+	}
+
+	/**
+	* \brief Occlusion test in (0, query.tMax), ignoring hits on query.excludeTriangle. Only instances have
+	* anything to exclude, and only when the triangle was hit through them.
+	*/
+	virtual bool DoesIntersect(const Ray& r, GeometryQuery& query) {
+		return DoesIntersect(r, query.tMax);
+	}
+
 	virtual UV GetUV(const vec3&) const = 0;
 	virtual BBox GetBBox() = 0;
 
@@ -101,6 +156,7 @@ public:
 	virtual ~Sphere() {};
 
 	Intersection GetIntersection(const Ray& r) override;
+	bool DoesIntersect(const Ray& r, float tMax) override;
 
 	UV GetUV(const vec3& point) const override {
 		glm::vec3 p = glm::normalize(point);
@@ -115,6 +171,9 @@ public:
 
 	BBox GetBBox() override;
 
+protected:
+	// Intersection in object space, t is along r_loc
+	bool GetLocalIntersection(const Ray& r_loc, float& t) const;
 };
 
 class Cube : public Geometry {
@@ -160,6 +219,7 @@ public:
 	}
 
 	Intersection GetIntersection(const Ray& r) override;
+	bool DoesIntersect(const Ray& r, float tMax) override;
 
 	UV GetUV(const vec3& point) const override {
 		glm::vec3 abs = glm::min(glm::abs(point), 0.5f);
@@ -208,6 +268,9 @@ public:
 
 	BBox GetBBox() override;
 
+protected:
+	// Intersection in object space, t is along r_loc
+	bool GetLocalIntersection(const Ray& r_loc, float& t) const;
 };
 
 class Triangle : public Geometry {
@@ -249,6 +312,15 @@ public:
 	}
 
 	Intersection GetIntersection(const Ray& r) override;
+	bool DoesIntersect(const Ray& r, float tMax) override;
+
+	/**
+	* \brief Resolves the shading attributes of a hit found by a separate intersection test
+	* \param r : the ray that hit the triangle
+	* \param t : distance along the ray
+	* \param u, v : barycentric coordinates of the hit with respect to vert1 and vert2
+	*/
+	Intersection GetShadingIntersection(const Ray& r, float t, float u, float v);
 
 	static float Area(const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3)
 	{
@@ -271,6 +343,10 @@ public:
 		vert1 = xform.T() * vec4(vert1, 1);
 		vert2 = xform.T() * vec4(vert2, 1);
 	}
+
+protected:
+	// Moller-Trumbore test shared by the closest hit and occlusion queries
+	bool GetBarycentricIntersection(const Ray& r, float& t, float& u, float& v) const;
 };
 
 class Mesh : public Geometry {
@@ -24,7 +24,8 @@ ColorRGB GlassMaterial::EvaluateEnergy(
 	const Direction& lightDirection,
 	const Ray& in,
 	Ray& out,
-	bool& shouldTerminate
+	bool& shouldTerminate,
+	RNG& rng
 )
 {
 	ColorRGB color(1.0, 1.0, 1.0);
@@ -63,8 +64,7 @@ ColorRGB GlassMaterial::EvaluateEnergy(
 	}
 
 	// Fresnel
-	static float r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-	if (r < reflectProb) {
+	if (rng.NextFloat() < reflectProb) {
 		out.m_direction = reflected;
 	} else {
 		out.m_direction = refracted;
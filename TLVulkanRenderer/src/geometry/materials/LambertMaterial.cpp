@@ -1,16 +1,13 @@
-#include <random>
 #include "LambertMaterial.h"
 #include <geometry/Geometry.h>
-#include <ctime>
 
-Point3 RandomInUnitSphere() {
-	srand((int)time(0));
+Point3 RandomInUnitSphere(RNG& rng) {
 	Point3 p;
 	float len = glm::length(p);
 	do {
-		float r1 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-		float r2 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-		float r3 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+		float r1 = rng.NextFloat();
+		float r2 = rng.NextFloat();
+		float r3 = rng.NextFloat();
 		p = 2.0f * Point3(r1, r2, r3) - Point3(1, 1, 1);
 		len = glm::length(p);
 	} while (len * len >= 1.0);
@@ -23,7 +20,8 @@ ColorRGB LambertMaterial::EvaluateEnergy(
 	const Direction& lightDirection,
 	const Ray& in,
 	Ray& out,
-	bool& shouldTerminate
+	bool& shouldTerminate,
+	RNG& rng
 )
 {
 	ColorRGB color;
@@ -35,7 +33,7 @@ ColorRGB LambertMaterial::EvaluateEnergy(
 		diffuse, 0.0f, 1.0f) * isx.hitTextureColor + m_colorAmbient;
 
 	// Out direction is some random on the hemisphere
-	Point3 target = isx.hitPoint + isx.hitNormal + RandomInUnitSphere();
+	Point3 target = isx.hitPoint + isx.hitNormal + RandomInUnitSphere(rng);
 	out.m_direction = glm::normalize(target - isx.hitPoint);
 	out.m_origin = isx.hitPoint;
 
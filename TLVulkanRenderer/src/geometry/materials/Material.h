@@ -5,6 +5,7 @@
 #include <scene/SceneUtil.h>
 #include <Color.h>
 #include <geometry/Ray.h>
+#include <Random.h>
 
 class Intersection;
 
@@ -32,7 +33,8 @@ public:
 		const Direction& lightDirection,
 		const Ray& in,
 		Ray& out,
-		bool& shouldTerminate
+		bool& shouldTerminate,
+		RNG& rng
 	) = 0;
 
 
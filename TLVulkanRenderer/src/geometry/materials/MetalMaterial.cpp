@@ -6,7 +6,8 @@ ColorRGB MetalMaterial::EvaluateEnergy(
 	const Direction& lightDirection,
 	const Ray& in,
 	Ray& out,
-	bool& shouldTerminate
+	bool& shouldTerminate,
+	RNG& rng
 	)
 {
 	ColorRGB color;
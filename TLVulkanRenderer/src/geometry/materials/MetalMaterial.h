@@ -14,8 +14,8 @@ public:
 		const Direction& lightDirection,
 		const Ray& in,
 		Ray& out,
-		bool& shouldTerminate
-
+		bool& shouldTerminate,
+		RNG& rng
 	) override;
 };
 
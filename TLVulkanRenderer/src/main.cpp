@@ -1,18 +1,254 @@
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cmath>
+#ifndef HEADLESS_ONLY
 #include "Application.h"
+#endif
+#include "OfflineRenderer.h"
+#include "Benchmark.h"
+#include "Profiler.h"
+
+using std::cout;
+using std::endl;
+
+void PrintUsage() {
+	cout << "Usage: VulkanRenderer [scene.gltf] [--headless] [options]\n"
+		<< "       VulkanRenderer --benchmark [scene.gltf...] [options]\n"
+		<< "HeadlessRenderer takes the same arguments and is always headless, it needs no Vulkan or GLFW runtime\n"
+		<< "Headless options, they all imply --headless:\n"
+		<< "  --output <file>      .pfm (float) or .ppm (8 bit), default render.pfm\n"
+		<< "                       benchmark: .json or .csv, default benchmark.json\n"
+		<< "  --width <pixels>     default 800\n"
+		<< "  --height <pixels>    default 600\n"
+		<< "  --spp <samples>      samples per pixel, default 64\n"
+		<< "  --threads <count>    default one per hardware thread\n"
+		<< "  --accel <SBVH|QBVH>  default QBVH\n"
+		<< "  --eye <x,y,z>        camera position, requires --lookat\n"
+		<< "  --lookat <x,y,z>     camera target, requires --eye\n"
+		<< "  --fov <degrees>      vertical field of view\n"
+		<< "  --aperture <radius>  thin lens radius for depth of field, default 0 (pinhole)\n"
+		<< "  --focus <distance>   distance to the plane in focus, default the look at distance\n"
+		<< "  --wavefront          trace tiles in batches of rays, same image\n"
+		<< "  --scene-cache        load the scene and its BVH from <scene>.tlcache, written when missing or stale\n"
+		<< "Benchmark mode runs every bundled scene unless scenes are given, --spp sets the samples\n"
+		<< "of its full render pass, default 4\n"
+		<< "Any mode:\n"
+		<< "  --profile <file>     prints a profile summary at exit and writes a Chrome trace" << endl;
+}
+
+// The whole argument must be the number, trailing characters make it invalid
+bool ParseUInt(const char* text, uint32_t& value) {
+	if (!isdigit(static_cast<unsigned char>(text[0]))) {
+		return false;
+	}
+	char* end;
+	errno = 0;
+	unsigned long parsed = strtoul(text, &end, 10);
+	if (*end != '\0' || errno == ERANGE || parsed > UINT32_MAX) {
+		return false;
+	}
+	value = static_cast<uint32_t>(parsed);
+	return true;
+}
+
+bool ParseFloat(const char* text, float& value) {
+	char* end;
+	value = strtof(text, &end);
+	return end != text && *end == '\0' && std::isfinite(value);
+}
+
+// x,y,z without spaces
+bool ParseVec3(const char* text, glm::vec3& v) {
+	for (int c = 0; c < 3; c++) {
+		char* end;
+		v[c] = strtof(text, &end);
+		if (end == text || !std::isfinite(v[c]) || *end != (c < 2 ? ',' : '\0')) {
+			return false;
+		}
+		text = end + 1;
+	}
+	return true;
+}
+
+int InvalidValue(const char* arg, const char* value) {
+	cout << "Invalid value " << value << " for " << arg << endl;
+	PrintUsage();
+	return 1;
+}
 
 int main(int argc, char** argv) {
 
 	// Default scenefile
 	std::string sceneFile = "scenes/gltfs/duck/duck.gltf";
-	if (argc != 2) {
+	std::vector<std::string> sceneFiles;
+	bool headless = false;
+	bool benchmark = false;
+	bool hasOutput = false;
+	bool hasSpp = false;
+	bool hasEye = false;
+	bool hasLookAt = false;
+	std::string profileFile;
+	OfflineRenderer::Settings settings;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (strcmp(arg, "--headless") == 0) {
+			headless = true;
+		} else if (strcmp(arg, "--benchmark") == 0) {
+			benchmark = true;
+		} else if (strcmp(arg, "--wavefront") == 0) {
+			settings.wavefront = true;
+			headless = true;
+		} else if (strcmp(arg, "--scene-cache") == 0) {
+			settings.sceneCache = true;
+			headless = true;
+		} else if (strncmp(arg, "--", 2) == 0 && !hasValue) {
+			cout << "Missing value for " << arg << endl;
+			PrintUsage();
+			return 1;
+		} else if (strcmp(arg, "--profile") == 0) {
+			profileFile = argv[++i];
+		} else if (strcmp(arg, "--output") == 0) {
+			settings.outputFile = argv[++i];
+			hasOutput = true;
+			headless = true;
+		} else if (strcmp(arg, "--width") == 0) {
+			if (!ParseUInt(argv[++i], settings.width) || settings.width == 0) {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strcmp(arg, "--height") == 0) {
+			if (!ParseUInt(argv[++i], settings.height) || settings.height == 0) {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strcmp(arg, "--spp") == 0) {
+			if (!ParseUInt(argv[++i], settings.samplesPerPixel) || settings.samplesPerPixel == 0) {
+				return InvalidValue(arg, argv[i]);
+			}
+			hasSpp = true;
+			headless = true;
+		} else if (strcmp(arg, "--threads") == 0) {
+			if (!ParseUInt(argv[++i], settings.numThreads)) {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strcmp(arg, "--accel") == 0) {
+			settings.accelStructure = argv[++i];
+			if (settings.accelStructure != "SBVH" && settings.accelStructure != "QBVH") {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strcmp(arg, "--eye") == 0) {
+			if (!ParseVec3(argv[++i], settings.eye)) {
+				return InvalidValue(arg, argv[i]);
+			}
+			hasEye = true;
+			headless = true;
+		} else if (strcmp(arg, "--lookat") == 0) {
+			if (!ParseVec3(argv[++i], settings.lookAt)) {
+				return InvalidValue(arg, argv[i]);
+			}
+			hasLookAt = true;
+			headless = true;
+		} else if (strcmp(arg, "--fov") == 0) {
+			if (!ParseFloat(argv[++i], settings.fovDegrees) || settings.fovDegrees <= 0 || settings.fovDegrees >= 180) {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strcmp(arg, "--aperture") == 0) {
+			if (!ParseFloat(argv[++i], settings.lensRadius) || settings.lensRadius < 0) {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strcmp(arg, "--focus") == 0) {
+			if (!ParseFloat(argv[++i], settings.focalDistance) || settings.focalDistance < 0) {
+				return InvalidValue(arg, argv[i]);
+			}
+			headless = true;
+		} else if (strncmp(arg, "--", 2) != 0) {
+			sceneFiles.push_back(arg);
+		} else {
+			cout << "Unknown argument " << arg << endl;
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (!profileFile.empty()) {
+		Profiler::SetEnabled(true);
+	}
+
+	// Reports once every render thread is idle
+	auto finish = [&](int result) {
+		if (!profileFile.empty()) {
+			Profiler::PrintSummary();
+			if (!Profiler::SaveChromeTrace(profileFile)) {
+				cout << "Failed to write " << profileFile << endl;
+				return 1;
+			}
+			cout << "Saved " << profileFile << endl;
+		}
+		return result;
+	};
+
+	if (benchmark) {
+		Benchmark::Settings benchmarkSettings;
+		benchmarkSettings.sceneFiles = sceneFiles;
+		benchmarkSettings.width = settings.width;
+		benchmarkSettings.height = settings.height;
+		benchmarkSettings.numThreads = settings.numThreads;
+		benchmarkSettings.accelStructure = settings.accelStructure;
+		benchmarkSettings.wavefront = settings.wavefront;
+		if (hasOutput) {
+			benchmarkSettings.outputFile = settings.outputFile;
+		}
+		if (hasSpp) {
+			benchmarkSettings.samplesPerPixel = settings.samplesPerPixel;
+		}
+		Benchmark bench(benchmarkSettings);
+		return finish(bench.Run() ? 0 : 1);
+	}
+
+	if (sceneFiles.size() > 1) {
+		cout << "Only benchmark mode takes more than one scene" << endl;
+		PrintUsage();
+		return 1;
+	}
+
+	if (sceneFiles.empty()) {
 		cout << "Missing scene file input! Loading default scene..." << endl;
 	} else {
-		sceneFile = argv[1];
+		sceneFile = sceneFiles[0];
+	}
+
+#ifdef HEADLESS_ONLY
+	// HeadlessRenderer links no Vulkan or GLFW, every render goes to a file
+	headless = true;
+#endif
+	if (headless) {
+		if (hasEye != hasLookAt) {
+			cout << "--eye and --lookat must be given together" << endl;
+			PrintUsage();
+			return 1;
+		}
+		settings.sceneFile = sceneFile;
+		settings.overrideCamera = hasEye && hasLookAt;
+		OfflineRenderer renderer(settings);
+		return finish(renderer.Run() ? 0 : 1);
 	}
 
+#ifndef HEADLESS_ONLY
 	// Launch our application using the Vulkan API
 	Application::PreInitialize(sceneFile, 800, 600, EGraphicsAPI::Vulkan, ERenderingMode::RAYTRACING_CPU);
 	Application::GetInstanced()->Run();
 	Application::Destroy();
+#endif
+	return finish(0);
 }
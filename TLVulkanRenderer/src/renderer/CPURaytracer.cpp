@@ -0,0 +1,467 @@
+#include "CPURaytracer.h"
+#include "geometry/Geometry.h"
+#include "Profiler.h"
+#include "renderer/samplers/SobolSampler.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+
+#define MULTITHREAD
+
+// Bounces traced with each light
+const int MAX_DEPTH = 3;
+
+vec3 ShadeBackground(const Ray& ray) {
+	float t = 0.5 * ray.m_direction.y + 1.0f;
+	return (1.0f - t) * vec3(1, 1, 1) + t * vec3(0.5, 0.7, 1.0);
+}
+
+/**
+ * \brief Ray from a shaded point toward the light
+ * \param distanceToLight : only occluders closer than this cast a shadow
+ */
+Ray GetShadowFeeler(const Intersection& isx, Light* light, float& distanceToLight) {
+	// Jitter shadow feeler for sotf shadow
+	//static float r1 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+	//r1 = r1 * 2.0f - 1.0f; // Spread between -1, and 1
+	//static float r2 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+	//r2 = r2 * 2.0f - 1.0f; // Spread between -1, and 1
+	//static float r3 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+	//r3 = r3 * 2.0f - 1.0f; // Spread between -1, and 1
+	Point3 jitter = isx.hitPoint;// t + isx.hitTangent * x;
+	Direction dir = normalize(light->GetPosition() - jitter);
+	jitter += EPSILON * dir;
+	distanceToLight = glm::distance(light->GetPosition(), jitter);
+	return Ray(jitter, dir);
+}
+
+vec3 ShadeMaterial(Scene* scene, Ray& newRay, RNG& rng) {
+	vec3 color; 
+	int depth = MAX_DEPTH;
+	for (auto light : scene->lights) {
+		int i = 0;
+		for (i = 0; i < depth; i++)
+		{
+			Intersection isx = scene->GetIntersection(newRay);
+			PROFILE_COUNT(i == 0 ? PrimaryRays : BounceRays, 1);
+			if (isx.t > 0)
+			{
+				vec3 lightDirection = glm::normalize(light->GetPosition() - isx.hitPoint);
+
+				if (i == 0) {
+					color = vec3(1, 1, 1);
+				}
+
+				// Shade material
+				bool shouldTerminate = false;
+				Ray reflectedRay;
+				vec3 newColor = isx.hitObject->GetMaterial()->EvaluateEnergy(isx, lightDirection, newRay, reflectedRay, shouldTerminate, rng);
+				if (shouldTerminate)
+				{
+					i = depth;
+				}
+				newRay = reflectedRay;
+				newColor *= light->Attenuation(isx.hitPoint);
+
+				// Shadow feeler. The triangle the feeler leaves from can't be an occluder.
+				float distanceToLight;
+				Ray shadowFeeler = GetShadowFeeler(isx, light, distanceToLight);
+				PROFILE_COUNT(ShadowRays, 1);
+				if (scene->DoesIntersect(shadowFeeler, distanceToLight, TriangleRef(isx.hitObject, isx.hitInstance)))
+				{
+					newColor *= 0.1f;
+				}
+				else
+				{
+					newColor *= light->GetColor();
+				}
+
+				color = newColor;
+			}
+			else
+			{
+				color = ShadeBackground(newRay);
+				break;
+			}
+		}
+	}
+	return color;
+}
+
+vec3 Raytrace(Ray& ray, Scene* scene, RNG& rng) {
+
+	return ShadeMaterial(scene, ray, rng);
+}
+
+/**
+ * \brief Camera ray through a film sample. Only thin lens cameras draw a lens sample from rng, so pinhole
+ * renders keep their random streams.
+ */
+Ray GenerateCameraRay(const Camera& camera, const vec2& filmSample, RNG& rng) {
+	if (camera.lensRadius > 0) {
+		vec2 lensSample(rng.NextFloat(), rng.NextFloat());
+		return camera.GenerateRay(filmSample.x, filmSample.y, lensSample);
+	}
+	return camera.GenerateRay(filmSample.x, filmSample.y);
+}
+
+// Small tiles keep every thread busy until the end of the frame, however uneven the scene is
+const uint32_t TILE_SIZE = 16;
+
+uint32_t GetNumTiles(
+	const Film* film
+	)
+{
+	uint32_t numTilesX = (film->GetWidth() + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t numTilesY = (film->GetHeight() + TILE_SIZE - 1) / TILE_SIZE;
+	return numTilesX * numTilesY;
+}
+
+/**
+ * \brief Adds one pass of samples to every pixel of the tile that hasn't reached maxSamples yet
+ * \param visualizeRayCost : accumulate the traversal cost heat map instead of the shaded color
+ */
+void RenderTile(
+	uint32_t tileIndex,
+	Scene* scene,
+	Film* film,
+	uint32_t maxSamples,
+	bool visualizeRayCost
+)
+{
+	// Shading is only counted, one event per sample would drown the trace
+	PROFILE_SCOPE("RenderTile");
+	uint32_t width = film->GetWidth();
+	uint32_t height = film->GetHeight();
+	uint32_t numTilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t startX = (tileIndex % numTilesX) * TILE_SIZE;
+	uint32_t endX = std::min(startX + TILE_SIZE, width);
+
+	uint32_t startY = (tileIndex / numTilesX) * TILE_SIZE;
+	uint32_t endY = std::min(startY + TILE_SIZE, height);
+
+	// One sample per pass keeps frames short while the camera moves, Sobol keeps refining across passes
+	SobolSampler sampler(ESamples::X1);
+	uint32_t numSamples = sampler.GetSampleCount();
+	vec2 samples[MAX_SAMPLES_PER_PIXEL];
+	for (uint32_t y = startY; y < endY; y++)
+	{
+		for (uint32_t x = startX; x < endX; x++)
+		{
+			uint32_t firstSample = film->GetSampleCount(x, y);
+			if (firstSample >= maxSamples)
+			{
+				continue;
+			}
+
+			// Every pixel and sample owns a stream, the image doesn't depend on which thread traced it
+			uint32_t pixelIndex = x + y * width;
+			RNG pixelRng(pixelIndex, 0);
+			sampler.Get2DSamples(vec2(x, y), pixelRng.NextUInt(), samples, firstSample);
+
+			vec3 color;
+			float rayTraversalCost = 0.0f;
+			for (uint32_t i = 0; i < numSamples; i++)
+			{
+				RNG rng(pixelIndex, firstSample + i + 1);
+				Ray newRay = GenerateCameraRay(scene->camera, samples[i], rng);
+				color += Raytrace(newRay, scene, rng);
+				rayTraversalCost += newRay.m_traversalCost;
+
+			}
+
+			// Traversal only records the cost when the scene asked for stats
+			if (visualizeRayCost)
+			{
+				rayTraversalCost /= numSamples;
+				vec3 costColor = vec3(0, 0, 0);
+				costColor.r = rayTraversalCost / 20.0f;
+				costColor.g = std::max((10.0f - rayTraversalCost) / 20.0f, 0.0f);
+				color = costColor * float(numSamples);
+			}
+
+			film->AddSamples(x, y, color, numSamples);
+		}
+	}
+}
+
+/**
+ * \brief Same samples and result as RenderTile, traced breadth first. Every wave intersects the current
+ * ray of all the tile's paths, shades the hits grouped by material, tests all their shadow rays, then
+ * gathers the bounces into the next wave. Paths follow ShadeMaterial exactly: each light gets up to
+ * MAX_DEPTH bounces, and the last shaded color is what the path returns.
+ * \param buffers : scratch memory owned by the calling thread
+ */
+void RenderTileWavefront(
+	uint32_t tileIndex,
+	Scene* scene,
+	Film* film,
+	uint32_t maxSamples,
+	WavefrontBuffers& buffers
+)
+{
+	PROFILE_SCOPE("RenderTileWavefront");
+	uint32_t width = film->GetWidth();
+	uint32_t height = film->GetHeight();
+	uint32_t numTilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t startX = (tileIndex % numTilesX) * TILE_SIZE;
+	uint32_t endX = std::min(startX + TILE_SIZE, width);
+
+	uint32_t startY = (tileIndex / numTilesX) * TILE_SIZE;
+	uint32_t endY = std::min(startY + TILE_SIZE, height);
+
+	std::vector<vec3>& pathColors = buffers.pathColors;
+	std::vector<RNG>& pathRngs = buffers.pathRngs;
+	std::vector<uint32_t>& pathPixels = buffers.pathPixels;
+	std::vector<uint32_t>& pathLights = buffers.pathLights;
+	std::vector<uint32_t>& pathBounces = buffers.pathBounces;
+	RayBatch& rays = buffers.rays;
+	uint32_t numLights = static_cast<uint32_t>(scene->lights.size());
+
+	// --- Primary rays, one path per sample, seeded like RenderTile's
+	SobolSampler sampler(ESamples::X1);
+	uint32_t numSamples = sampler.GetSampleCount();
+	vec2 samples[MAX_SAMPLES_PER_PIXEL];
+	buffers.ClearPaths();
+	rays.Clear();
+	for (uint32_t y = startY; y < endY; y++)
+	{
+		for (uint32_t x = startX; x < endX; x++)
+		{
+			uint32_t firstSample = film->GetSampleCount(x, y);
+			if (firstSample >= maxSamples)
+			{
+				continue;
+			}
+
+			uint32_t pixelIndex = x + y * width;
+			RNG pixelRng(pixelIndex, 0);
+			sampler.Get2DSamples(vec2(x, y), pixelRng.NextUInt(), samples, firstSample);
+
+			for (uint32_t i = 0; i < numSamples; i++)
+			{
+				uint32_t path = static_cast<uint32_t>(pathColors.size());
+				pathColors.push_back(vec3());
+				pathRngs.push_back(RNG(pixelIndex, firstSample + i + 1));
+				pathPixels.push_back(pixelIndex);
+				pathLights.push_back(0);
+				pathBounces.push_back(0);
+
+				// Without lights the path stays black, as in ShadeMaterial
+				if (numLights > 0)
+				{
+					Ray ray = GenerateCameraRay(scene->camera, samples[i], pathRngs.back());
+					rays.Push(ray.m_origin, ray.m_direction, FLT_MAX, TriangleRef(), path);
+				}
+			}
+		}
+	}
+
+	std::vector<Intersection>& hits = buffers.hits;
+	std::vector<uint32_t>& shadeOrder = buffers.shadeOrder;
+	RayBatch& shadowRays = buffers.shadowRays;
+	std::vector<vec3>& shadowColors = buffers.shadowColors;
+	RayBatch& continuations = buffers.continuations;
+	std::vector<uint8_t>& continuationEnds = buffers.continuationEnds;
+	std::vector<uint8_t>& occluded = buffers.occluded;
+	RayBatch& nextRays = buffers.nextRays;
+	while (rays.Size() > 0)
+	{
+		// --- Closest hits of the whole wave. Neighbouring rays come from neighbouring pixels or hits, so
+		// they're traced as packets.
+		size_t numRays = rays.Size();
+		hits.resize(numRays);
+		shadeOrder.clear();
+		for (size_t first = 0; first < numRays; first += RAY_PACKET_SIZE)
+		{
+			uint32_t packetSize = static_cast<uint32_t>(std::min<size_t>(numRays - first, RAY_PACKET_SIZE));
+			Ray packet[RAY_PACKET_SIZE];
+			for (uint32_t i = 0; i < packetSize; i++)
+			{
+				packet[i] = Ray(rays.origins[first + i], rays.directions[first + i]);
+			}
+			scene->GetIntersectionPacket(packet, packetSize, &hits[first]);
+
+			for (uint32_t i = 0; i < packetSize; i++)
+			{
+				size_t r = first + i;
+				uint32_t path = rays.paths[r];
+				PROFILE_COUNT(pathBounces[path] == 0 ? PrimaryRays : BounceRays, 1);
+				if (hits[r].t > 0)
+				{
+					shadeOrder.push_back(static_cast<uint32_t>(r));
+				}
+				else
+				{
+					// The same ray would miss again with every remaining light, so the path ends on the sky
+					pathColors[path] = ShadeBackground(packet[i]);
+				}
+			}
+		}
+
+		// --- Shade the hits grouped by material, so neighbouring hits run the same code on the same data.
+		// Every path draws from its own RNG, the order doesn't change the result.
+		std::sort(shadeOrder.begin(), shadeOrder.end(), [&hits](uint32_t a, uint32_t b) {
+			Material* materialA = hits[a].hitObject->GetMaterial();
+			Material* materialB = hits[b].hitObject->GetMaterial();
+			return materialA != materialB ? std::less<Material*>()(materialA, materialB) : a < b;
+		});
+
+		shadowRays.Clear();
+		shadowColors.clear();
+		continuations.Clear();
+		continuationEnds.clear();
+		for (uint32_t r : shadeOrder)
+		{
+			const Intersection& isx = hits[r];
+			uint32_t path = rays.paths[r];
+			Light* light = scene->lights[pathLights[path]];
+			vec3 lightDirection = glm::normalize(light->GetPosition() - isx.hitPoint);
+
+			bool shouldTerminate = false;
+			Ray ray(rays.origins[r], rays.directions[r]);
+			Ray reflectedRay;
+			vec3 newColor = isx.hitObject->GetMaterial()->EvaluateEnergy(isx, lightDirection, ray, reflectedRay, shouldTerminate, pathRngs[path]);
+			newColor *= light->Attenuation(isx.hitPoint);
+
+			float distanceToLight;
+			Ray shadowFeeler = GetShadowFeeler(isx, light, distanceToLight);
+			shadowRays.Push(shadowFeeler.m_origin, shadowFeeler.m_direction, distanceToLight, TriangleRef(isx.hitObject, isx.hitInstance), path);
+			shadowColors.push_back(newColor);
+			continuations.Push(reflectedRay.m_origin, reflectedRay.m_direction, FLT_MAX, TriangleRef(), path);
+			continuationEnds.push_back(shouldTerminate);
+		}
+
+		// --- Shadow rays only need to know whether anything is in the way. Rays toward the same light
+		// converge, they make good packets as well.
+		size_t numShadowRays = shadowRays.Size();
+		occluded.resize(numShadowRays);
+		for (size_t first = 0; first < numShadowRays; first += RAY_PACKET_SIZE)
+		{
+			uint32_t packetSize = static_cast<uint32_t>(std::min<size_t>(numShadowRays - first, RAY_PACKET_SIZE));
+			Ray packet[RAY_PACKET_SIZE];
+			for (uint32_t i = 0; i < packetSize; i++)
+			{
+				packet[i] = Ray(shadowRays.origins[first + i], shadowRays.directions[first + i]);
+			}
+			bool packetOccluded[RAY_PACKET_SIZE];
+			scene->DoesIntersectPacket(packet, packetSize, &shadowRays.tMax[first], &shadowRays.excludeTriangles[first], packetOccluded);
+			std::copy(packetOccluded, packetOccluded + packetSize, occluded.begin() + first);
+			PROFILE_COUNT(ShadowRays, packetSize);
+		}
+
+		nextRays.Clear();
+		for (size_t s = 0; s < numShadowRays; s++)
+		{
+			uint32_t path = shadowRays.paths[s];
+			vec3 newColor = shadowColors[s];
+			if (occluded[s])
+			{
+				newColor *= 0.1f;
+			}
+			else
+			{
+				newColor *= scene->lights[pathLights[path]]->GetColor();
+			}
+			pathColors[path] = newColor;
+
+			// The bounce continues with the same light, or starts over with the next one once the material
+			// ended the path or the depth is reached
+			if (continuationEnds[s] || ++pathBounces[path] >= MAX_DEPTH)
+			{
+				pathBounces[path] = 0;
+				if (++pathLights[path] == numLights)
+				{
+					continue;
+				}
+			}
+			nextRays.Push(continuations.origins[s], continuations.directions[s], FLT_MAX, TriangleRef(), path);
+		}
+		std::swap(rays, nextRays);
+	}
+
+	// --- Paths of a pixel are contiguous and in sample order, they add up as in RenderTile
+	size_t numPaths = pathColors.size();
+	for (size_t path = 0; path < numPaths;)
+	{
+		uint32_t pixelIndex = pathPixels[path];
+		vec3 color;
+		uint32_t numPixelSamples = 0;
+		for (; path < numPaths && pathPixels[path] == pixelIndex; path++)
+		{
+			color += pathColors[path];
+			numPixelSamples++;
+		}
+		film->AddSamples(pixelIndex % width, pixelIndex / width, color, numPixelSamples);
+	}
+}
+
+CPURaytracer::CPURaytracer(
+	Scene* scene,
+	uint32_t width,
+	uint32_t height,
+	uint32_t numThreads
+	) : m_scene(scene), m_film(width, height),
+#ifdef MULTITHREAD
+	m_threadPool(numThreads),
+#else
+	m_threadPool(1),
+#endif
+	m_wavefrontBuffers(m_threadPool.GetNumThreads()),
+	m_lastViewProj(scene->camera.GetViewProj())
+{
+}
+
+void
+CPURaytracer::RenderFrame() {
+	PROFILE_SCOPE("CPURaytracer::RenderFrame");
+
+	// Any camera movement invalidates the samples gathered so far
+	glm::mat4 viewProj = m_scene->camera.GetViewProj();
+	if (viewProj != m_lastViewProj) {
+		m_lastViewProj = viewProj;
+		ResetAccumulation();
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	auto deadline = Clock::now() + std::chrono::microseconds(static_cast<int64_t>(m_frameBudgetMs * 1000.0f));
+
+	// The first pass after a reset always covers the whole film, so no part of the screen is left black.
+	// Later passes pick up where the previous frame stopped and give up once the budget is spent.
+	bool ignoreBudget = !m_hasCompletePass || m_frameBudgetMs <= 0;
+	Scene* scene = m_scene;
+	Film* film = &m_film;
+	uint32_t numTiles = GetNumTiles(film);
+	uint32_t firstTile = m_nextTile;
+	uint32_t maxSamples = m_maxSamples;
+	bool visualizeRayCost = m_visualizeRayCost;
+	// The heat map needs the cost of each sample's rays, which only the depth first tiles keep
+	bool useWavefront = m_useWavefront && !visualizeRayCost;
+	std::vector<WavefrontBuffers>& wavefrontBuffers = m_wavefrontBuffers;
+	std::atomic<uint32_t> numTilesRendered{0};
+	m_threadPool.ParallelFor(numTiles, [&](uint32_t, uint32_t threadId)
+	{
+		// The deadline is checked before a tile is taken, and every tile taken is rendered, so the rendered
+		// tiles always are the first numTilesRendered ones even when threads race past the deadline
+		if (!ignoreBudget && numTilesRendered.load() > 0 && Clock::now() > deadline) {
+			return;
+		}
+		uint32_t tileIndex = (firstTile + numTilesRendered++) % numTiles;
+		if (useWavefront) {
+			RenderTileWavefront(tileIndex, scene, film, maxSamples, wavefrontBuffers[threadId]);
+		} else {
+			RenderTile(tileIndex, scene, film, maxSamples, visualizeRayCost);
+		}
+	});
+
+	m_nextTile = (firstTile + numTilesRendered) % numTiles;
+	m_hasCompletePass = m_hasCompletePass || numTilesRendered == numTiles;
+}
+
+void
+CPURaytracer::ResetAccumulation() {
+	m_film.Clear();
+	m_nextTile = 0;
+	m_hasCompletePass = false;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "scene/Scene.h"
+#include "renderer/Film.h"
+#include "renderer/ThreadPool.h"
+#include "renderer/Wavefront.h"
+
+/**
+ * \brief Multithreaded progressive ray tracer writing into a Film. It doesn't depend on any graphics API:
+ * the Vulkan CPU renderer uploads its film to the screen and headless renders save it to disk.
+ */
+class CPURaytracer
+{
+public:
+	/**
+	 * \param width, height : film resolution, should match the scene camera's
+	 * \param numThreads : 0 to use one thread per hardware thread
+	 */
+	CPURaytracer(
+		Scene* scene,
+		uint32_t width,
+		uint32_t height,
+		uint32_t numThreads = 0
+	);
+
+	/**
+	 * \brief Adds one sample to the pixels of as many tiles as fit in the frame budget.
+	 * The film is reset first if the camera moved since the last frame.
+	 */
+	void
+	RenderFrame();
+
+	/**
+	 * \brief Drops every accumulated sample
+	 */
+	void
+	ResetAccumulation();
+
+	/**
+	 * \brief Frames stop taking new tiles once they have run this long, 0 to always render complete passes
+	 */
+	void SetFrameBudget(float milliseconds) {
+		m_frameBudgetMs = milliseconds;
+	}
+
+	/**
+	 * \brief Pixels stop refining once they hold this many samples
+	 */
+	void SetMaxSamples(uint32_t maxSamples) {
+		m_maxSamples = maxSamples;
+	}
+
+	/**
+	 * \brief Shows the traversal cost heat map instead of shading, the scene must record traversal stats
+	 */
+	void SetVisualizeRayCost(bool visualizeRayCost) {
+		m_visualizeRayCost = visualizeRayCost;
+	}
+
+	/**
+	 * \brief Traces each tile in waves of rays sharing a bounce instead of one sample at a time, in ray
+	 * packets. The image is the same up to ties between equally close hits, the heat map always uses the
+	 * per sample tiles.
+	 */
+	void SetWavefront(bool useWavefront) {
+		m_useWavefront = useWavefront;
+	}
+
+	Film& GetFilm() {
+		return m_film;
+	}
+
+	uint32_t GetNumThreads() const {
+		return m_threadPool.GetNumThreads();
+	}
+
+protected:
+	Scene* m_scene;
+	Film m_film;
+	ThreadPool m_threadPool;
+
+	// Indexed by the worker's thread id
+	std::vector<WavefrontBuffers> m_wavefrontBuffers;
+
+	// View projection the film was accumulated with
+	glm::mat4 m_lastViewProj;
+
+	// Tile the next frame starts from
+	uint32_t m_nextTile = 0;
+
+	bool m_hasCompletePass = false;
+
+	float m_frameBudgetMs = 33.0f;
+	uint32_t m_maxSamples = 1024;
+	bool m_visualizeRayCost = false;
+	bool m_useWavefront = false;
+};
@@ -0,0 +1,50 @@
+#include "Film.h"
+#include <fstream>
+
+bool Film::SavePFM(
+	const std::string& fileName
+	) const
+{
+	std::ofstream file(fileName, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	// A negative scale marks little endian data, rows are stored bottom to top
+	file << "PF\n" << m_width << " " << m_height << "\n-1.0\n";
+	std::vector<float> row(m_width * 3);
+	for (int y = m_height - 1; y >= 0; y--)
+	{
+		for (uint32_t x = 0; x < m_width; x++)
+		{
+			glm::vec3 color = GetAverage(x, y);
+			row[x * 3] = color.r;
+			row[x * 3 + 1] = color.g;
+			row[x * 3 + 2] = color.b;
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+
+	return file.good();
+}
+
+bool Film::SavePPM(
+	const std::string& fileName
+	) const
+{
+	std::ofstream file(fileName, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	file << "P6\n" << m_width << " " << m_height << "\n255\n";
+	for (uint32_t pixel = 0; pixel < m_width * m_height; pixel++)
+	{
+		// Drop alpha
+		file.write(&m_data[pixel * 4], 3);
+	}
+
+	return file.good();
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include <vector>
+#include <string>
+#include <algorithm>
 #include <glm/glm.hpp>
 
 class Film
@@ -7,7 +9,9 @@ class Film
 public:
 	// Assume 4 channels
 	Film(uint32_t width, uint32_t height) :
-		m_width(width), m_height(height), m_data{std::vector<char>(width * height * 4) }
+		m_width(width), m_height(height),
+		m_accumulation{std::vector<glm::vec4>(width * height, glm::vec4(0))},
+		m_data{std::vector<char>(width * height * 4) }
 	{}
 
 	void SetPixel(int x, int y, glm::vec4 color) {
@@ -18,8 +22,49 @@ public:
 		m_data[offset + 3] = color.a;
 	}
 
+	/**
+	 * \brief Adds samples to the running sum of a pixel and writes the new average to the display data
+	 * \param colorSum : sum of the new samples' radiance, in [0, 1] per sample
+	 * \param numSamples : number of samples summed in colorSum
+	 */
+	void AddSamples(int x, int y, const glm::vec3& colorSum, uint32_t numSamples) {
+		glm::vec4& accumulated = m_accumulation[x + y * m_width];
+		accumulated += glm::vec4(colorSum, numSamples);
+
+		glm::vec3 average = glm::vec3(accumulated) / accumulated.w;
+		SetPixel(x, y, glm::vec4(glm::clamp(average * 255.0f, 0.f, 255.f), 1));
+	}
+
+	/**
+	 * \brief Number of samples accumulated in a pixel since the last Clear
+	 */
+	uint32_t GetSampleCount(int x, int y) const {
+		return static_cast<uint32_t>(m_accumulation[x + y * m_width].w);
+	}
+
+	/**
+	 * \brief Average of the samples accumulated in a pixel, unclamped
+	 */
+	glm::vec3 GetAverage(int x, int y) const {
+		const glm::vec4& accumulated = m_accumulation[x + y * m_width];
+		return accumulated.w > 0 ? glm::vec3(accumulated) / accumulated.w : glm::vec3(0);
+	}
+
+	/**
+	 * \brief Writes the unclamped averages as a little endian float PFM image
+	 * \return false if the file couldn't be written
+	 */
+	bool SavePFM(const std::string& fileName) const;
+
+	/**
+	 * \brief Writes the 8 bit display data as a binary PPM image
+	 * \return false if the file couldn't be written
+	 */
+	bool SavePPM(const std::string& fileName) const;
+
 	void Clear() {
-		m_data = vector<char>(m_width * m_height * 4);
+		std::fill(m_accumulation.begin(), m_accumulation.end(), glm::vec4(0));
+		std::fill(m_data.begin(), m_data.end(), 0);
 	}
 
 
@@ -38,5 +83,8 @@ public:
 private:
 	uint32_t m_width;
 	uint32_t m_height;
+
+	// Running sum of every sample per pixel, w holds the sample count
+	std::vector<glm::vec4> m_accumulation;
 	std::vector<char> m_data;
 };
@@ -0,0 +1,104 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+
+ThreadPool::ThreadPool(
+	uint32_t numThreads
+	)
+{
+	if (numThreads == 0)
+	{
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	// The thread calling ParallelFor is the first worker
+	for (uint32_t threadId = 1; threadId < numThreads; threadId++)
+	{
+		m_workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, threadId));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void
+ThreadPool::ParallelFor(
+	uint32_t count,
+	const Job& job
+	)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(m_numBusyWorkers == 0 && "ParallelFor isn't reentrant");
+		m_job = &job;
+		m_count = count;
+		m_nextIndex.store(0);
+		m_numBusyWorkers = m_workers.size();
+		m_generation++;
+	}
+	m_wakeCondition.notify_all();
+
+	RunItems(0);
+
+	// Items may still be in flight on other threads even though the counter ran out
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this] { return m_numBusyWorkers == 0; });
+	m_job = nullptr;
+}
+
+void
+ThreadPool::WorkerLoop(
+	uint32_t threadId
+	)
+{
+	uint64_t lastGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeCondition.wait(lock, [&] { return m_quit || m_generation != lastGeneration; });
+			if (m_quit)
+			{
+				return;
+			}
+			lastGeneration = m_generation;
+		}
+
+		RunItems(threadId);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_numBusyWorkers == 0)
+			{
+				m_doneCondition.notify_one();
+			}
+		}
+	}
+}
+
+void
+ThreadPool::RunItems(
+	uint32_t threadId
+	)
+{
+	while (true)
+	{
+		uint32_t index = m_nextIndex.fetch_add(1, std::memory_order_relaxed);
+		if (index >= m_count)
+		{
+			return;
+		}
+		(*m_job)(index, threadId);
+	}
+}
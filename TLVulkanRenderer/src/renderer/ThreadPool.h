@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Fixed set of worker threads kept alive for the lifetime of the renderer, so frames don't pay
+ * for thread creation. Work is split into small items that workers grab from a shared atomic counter,
+ * a thread done with a cheap item simply takes the next one instead of idling until the frame ends.
+ */
+class ThreadPool
+{
+public:
+	/**
+	 * \brief Work item callback
+	 * \param index : item to process, in [0, count)
+	 * \param threadId : in [0, GetNumThreads()), stable for the whole call so it can index per thread state
+	 */
+	typedef std::function<void(uint32_t index, uint32_t threadId)> Job;
+
+	/**
+	 * \param numThreads : total number of threads including the caller, 0 to use one per hardware thread
+	 */
+	explicit ThreadPool(uint32_t numThreads = 0);
+
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**
+	 * \brief Runs job on every index in [0, count) and blocks until all of them are done.
+	 * The calling thread takes part as thread 0.
+	 */
+	void
+	ParallelFor(
+		uint32_t count,
+		const Job& job
+	);
+
+	inline uint32_t GetNumThreads() const {
+		return m_workers.size() + 1;
+	}
+
+private:
+	void
+	WorkerLoop(uint32_t threadId);
+
+	void
+	RunItems(uint32_t threadId);
+
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeCondition;
+	std::condition_variable m_doneCondition;
+
+	// Bumped for every ParallelFor so sleeping workers know there is a new job
+	uint64_t m_generation = 0;
+	uint32_t m_numBusyWorkers = 0;
+	bool m_quit = false;
+
+	const Job* m_job = nullptr;
+	uint32_t m_count = 0;
+	std::atomic<uint32_t> m_nextIndex{0};
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "geometry/Geometry.h"
+#include <Random.h>
+#include <vector>
+
+/**
+ * \brief One wave of rays in SoA layout, each attribute in its own array so a pass over the batch only
+ * streams through the attributes it reads.
+ */
+struct RayBatch
+{
+	std::vector<Point3> origins;
+	std::vector<Direction> directions;
+	std::vector<float> tMax;
+	std::vector<TriangleRef> excludeTriangles; // Shadow rays skip the triangle they leave from
+	std::vector<uint32_t> paths; // Path each ray extends
+
+	void Clear() {
+		origins.clear();
+		directions.clear();
+		tMax.clear();
+		excludeTriangles.clear();
+		paths.clear();
+	}
+
+	void Push(
+		const Point3& origin,
+		const Direction& direction,
+		float rayTMax,
+		const TriangleRef& excludeTriangle,
+		uint32_t path
+	) {
+		origins.push_back(origin);
+		directions.push_back(direction);
+		tMax.push_back(rayTMax);
+		excludeTriangles.push_back(excludeTriangle);
+		paths.push_back(path);
+	}
+
+	size_t Size() const {
+		return paths.size();
+	}
+};
+
+/**
+ * \brief Scratch memory of the wavefront tracer. One per render thread, the vectors keep their capacity
+ * from tile to tile so nothing is allocated once the first tiles are done.
+ */
+struct WavefrontBuffers
+{
+	// Per path, one path per sample of the tile
+	std::vector<glm::vec3> pathColors; // What the path returns if it ends now
+	std::vector<RNG> pathRngs;
+	std::vector<uint32_t> pathPixels;
+	std::vector<uint32_t> pathLights; // Light the path is currently shaded with
+	std::vector<uint32_t> pathBounces; // Bounces traced with that light
+
+	// Per wave
+	RayBatch rays;
+	std::vector<Intersection> hits;
+	std::vector<uint32_t> shadeOrder; // Rays that hit something, sorted by material
+	RayBatch shadowRays;
+	std::vector<glm::vec3> shadowColors; // Shading of each shadow ray's hit, before occlusion
+	RayBatch continuations; // Bounce sampled at each shadow ray's hit
+	std::vector<uint8_t> continuationEnds; // The material ended the path with the current light
+	std::vector<uint8_t> occluded; // Per shadow ray
+	RayBatch nextRays;
+
+	void ClearPaths() {
+		pathColors.clear();
+		pathRngs.clear();
+		pathPixels.clear();
+		pathLights.clear();
+		pathBounces.clear();
+	}
+};
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
+#include <cstdint>
 
 
 enum ESamples
@@ -12,13 +12,54 @@ enum ESamples
 	X16
 };
 
+// Capacity callers need for Get2DSamples, no sampler produces more per pixel
+const uint32_t MAX_SAMPLES_PER_PIXEL = 16;
+
+/**
+ * \brief Samplers are stateless, sample i of a pixel only depends on the pixel and its seed.
+ * They can be shared between threads and never allocate.
+ */
 class Sampler {
 	
 public:
 	Sampler() {};
 
-	virtual std::vector<glm::vec2> Get2DSamples(const glm::vec2& point) = 0;
+	virtual ~Sampler() {};
+
+	/**
+	 * \brief Number of samples generated per pixel, at most MAX_SAMPLES_PER_PIXEL
+	 */
+	virtual uint32_t GetSampleCount() const = 0;
+
+	/**
+	 * \brief Position of one sample inside the pixel at point
+	 * \param sampleIndex : index of the sample in the pixel. Progressive rendering keeps counting past
+	 * GetSampleCount(), grid samplers wrap around while Sobol keeps refining.
+	 * \param seed : per pixel seed, decorrelates the random samplers between pixels
+	 */
+	virtual glm::vec2 Get2DSample(const glm::vec2& point, uint32_t sampleIndex, uint32_t seed) const = 0;
+
+	/**
+	 * \brief Fills samples with GetSampleCount() positions of the pixel at point, starting at firstSampleIndex
+	 */
+	void Get2DSamples(const glm::vec2& point, uint32_t seed, glm::vec2* samples, uint32_t firstSampleIndex = 0) const {
+		uint32_t count = GetSampleCount();
+		for (uint32_t i = 0; i < count; i++) {
+			samples[i] = Get2DSample(point, firstSampleIndex + i, seed);
+		}
+	}
 
 protected:
-	unsigned int m_samplesPerPoint;
+	/**
+	 * \brief Side of the square grid used by the grid based samplers, X8 has always been a 3x3 grid
+	 */
+	static uint32_t GetGridSize(ESamples numSamples) {
+		switch (numSamples) {
+			case X4: return 2;
+			case X8: return 3;
+			case X16: return 4;
+			case X1:
+			default: return 1;
+		}
+	}
 };
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Sampler.h"
+
+/**
+ * \brief First two dimensions of the Sobol sequence with hash based Owen scrambling, see
+ * Burley, "Practical Hash-based Owen Scrambling", JCGT 2020. Any power of two prefix is well stratified,
+ * so it converges faster than the grid samplers at the same sample count. Each pixel gets its own
+ * scramble from the seed, which turns structured aliasing into noise.
+ */
+class SobolSampler : public Sampler
+{
+public:
+	SobolSampler() : Sampler(), m_sampleCount(4) {
+	}
+
+	SobolSampler(ESamples numSamples) : m_sampleCount(GetSobolSampleCount(numSamples)) {
+	}
+
+	uint32_t GetSampleCount() const override {
+		return m_sampleCount;
+	}
+
+	glm::vec2 Get2DSample(const glm::vec2& point, uint32_t sampleIndex, uint32_t seed) const override {
+
+		// Shuffle the order of the points too, so that a prefix of the samples isn't the same subset in every pixel
+		uint32_t index = NestedUniformScramble(sampleIndex, HashCombine(seed, 0));
+		uint32_t x = NestedUniformScramble(ReverseBits(index), HashCombine(seed, 1));
+		uint32_t y = NestedUniformScramble(SobolDimension1(index), HashCombine(seed, 2));
+		return{ point.x + ToUnitFloat(x), point.y + ToUnitFloat(y) };
+	}
+
+protected:
+	uint32_t m_sampleCount;
+
+	// Sample counts are kept to powers of two, that's where Sobol is stratified
+	static uint32_t GetSobolSampleCount(ESamples numSamples) {
+		switch (numSamples) {
+			case X4: return 4;
+			case X8: return 8;
+			case X16: return 16;
+			case X1:
+			default: return 1;
+		}
+	}
+
+	static uint32_t ReverseBits(uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+		x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+		x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+		x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+		return x;
+	}
+
+	// Second Sobol dimension, generated by the primitive polynomial x + 1
+	static uint32_t SobolDimension1(uint32_t index) {
+		uint32_t result = 0;
+		uint32_t direction = 1u << 31;
+		for (; index != 0; index >>= 1) {
+			if (index & 1) {
+				result ^= direction;
+			}
+			direction ^= direction >> 1;
+		}
+		return result;
+	}
+
+	static uint32_t Hash(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352d;
+		x ^= x >> 15;
+		x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+
+	static uint32_t HashCombine(uint32_t seed, uint32_t value) {
+		return seed ^ (Hash(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+	}
+
+	// Owen scrambling on reversed bits: each bit only depends on the bits above it
+	static uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+		x += seed;
+		x ^= x * 0x6c50b47c;
+		x ^= x * 0xb82f1e52;
+		x ^= x * 0xc7afe638;
+		x ^= x * 0x8d22f6e6;
+		return x;
+	}
+
+	static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+		return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+	}
+
+	static float ToUnitFloat(uint32_t x) {
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
+};
@@ -6,48 +6,36 @@ class UniformSampler : public Sampler {
 public:
 
 
-	UniformSampler() : Sampler(), m_uniformSamples(X4) {
+	UniformSampler() : Sampler(), m_gridSize(GetGridSize(X4)) {
 	}
 
-	UniformSampler(ESamples numSamples) : m_uniformSamples(numSamples) {	
+	UniformSampler(ESamples numSamples) : m_gridSize(GetGridSize(numSamples)) {	
 	}
 
-	std::vector<glm::vec2> Get2DSamples(const glm::vec2& point) override {
-
-		std::vector<glm::vec2> samples;
-		switch(m_uniformSamples) {
-			case X4:
-				samples.push_back({ point.x + 0.25f, point.y + 0.25f });
-				samples.push_back({ point.x + 0.25f, point.y + 0.75f });
-				samples.push_back({ point.x + 0.75f, point.y + 0.25f });
-				samples.push_back({ point.x + 0.75f, point.y + 0.75f });
-				break;
-			case X8:
-				for (float x = 0.25f; x <= 0.75f; x += .25f) {
-					for (float y = 0.25f; y <= 0.75f; y += .25f)
-					{
-						samples.push_back({ point.x + x, point.y + y });
-					}
-				}
-				break;
-			case X16:
-				for (float x = 0.2f; x <= 0.8f; x += .2f)
-				{
-					for (float y = 0.2f; y <= 0.8f; y += .2f)
-					{
-						samples.push_back({ point.x + x, point.y + y });
-					}
-				}
-				break;
-			case X1:
-			default:
-				samples.push_back(point);
-				break;
+	uint32_t GetSampleCount() const override {
+		return m_gridSize * m_gridSize;
+	}
+
+	glm::vec2 Get2DSample(const glm::vec2& point, uint32_t sampleIndex, uint32_t seed) const override {
+
+		if (m_gridSize == 1) {
+			return point;
 		}
 
-		return samples;
+		// Evenly spaced inside the pixel, except 2x2 which keeps the usual quarter offsets
+		float first, step;
+		if (m_gridSize == 2) {
+			first = 0.25f;
+			step = 0.5f;
+		} else {
+			first = step = 1.0f / (m_gridSize + 1);
+		}
+		uint32_t cell = sampleIndex % GetSampleCount();
+		uint32_t i = cell / m_gridSize;
+		uint32_t j = cell % m_gridSize;
+		return{ point.x + first + i * step, point.y + first + j * step };
 	}
 
 protected:
-	ESamples m_uniformSamples;
+	uint32_t m_gridSize;
 };
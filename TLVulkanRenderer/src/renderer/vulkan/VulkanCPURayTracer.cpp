@@ -1,140 +1,37 @@
 #include "VulkanCPURayTracer.h"
 #include "tinygltfloader/stb_image.h"
 #include "Utilities.h"
+#include "Profiler.h"
 #include "geometry/Geometry.h"
 #include "scene/Camera.h"
-#include "renderer/samplers/UniformSampler.h"
-#include "renderer/samplers/StratifiedSampler.h"
 #include <iostream>
 
-#define MULTITHREAD
-
-vec3 ShadeMaterial(Scene* scene, Ray& newRay) {
-	vec3 color; 
-	int depth = 3;
-	for (auto light : scene->lights) {
-		int i = 0;
-		for (i = 0; i < depth; i++)
-		{
-			Intersection isx = scene->GetIntersection(newRay);
-			if (isx.t > 0)
-			{
-				vec3 lightDirection = glm::normalize(light->GetPosition() - isx.hitPoint);
-
-				if (i == 0) {
-					color = vec3(1, 1, 1);
-				}
-
-				// Shade material
-				bool shouldTerminate = false;
-				Ray reflectedRay;
-				vec3 newColor = isx.hitObject->GetMaterial()->EvaluateEnergy(isx, lightDirection, newRay, reflectedRay, shouldTerminate);
-				if (shouldTerminate)
-				{
-					i = depth;
-				}
-				newRay = reflectedRay;
-				newColor *= light->Attenuation(isx.hitPoint);
-
-				// Shadow feeler
-				// Jitter shadow feeler for sotf shadow
-				//static float r1 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-				//r1 = r1 * 2.0f - 1.0f; // Spread between -1, and 1
-				//static float r2 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-				//r2 = r2 * 2.0f - 1.0f; // Spread between -1, and 1
-				//static float r3 = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-				//r3 = r3 * 2.0f - 1.0f; // Spread between -1, and 1
-				Point3 jitter = isx.hitPoint;// t + isx.hitTangent * x;
-				Direction dir = normalize(light->GetPosition() - jitter);
-				jitter += EPSILON * dir;
-
-				Ray shadowFeeler(jitter, dir);
-				if (scene->DoesIntersect(shadowFeeler))
-				{
-					newColor *= 0.1f;
-				}
-				else
-				{
-					newColor *= light->GetColor();
-				}
-
-				color = newColor;
-			}
-			else
-			{
-				// Shade background
-				float t = 0.5 * newRay.m_direction.y + 1.0f;
-				color = (1.0f - t) * vec3(1, 1, 1) + t * vec3(0.5, 0.7, 1.0);
-				break;
-			}
-		}
-	}
-	return color;
-}
-
-vec3 Raytrace(Ray& ray, Scene* scene) {
-
-	return ShadeMaterial(scene, ray);
-}
-
-void Task(
-	uint32_t tileX,
-	uint32_t tileY,
+VulkanCPURaytracer::VulkanCPURaytracer(
+	GLFWwindow* window, 
 	Scene* scene,
-	Film* film,
-	queue<Ray>& raysQueue
-)
+	std::shared_ptr<std::map<string, string>> config
+	) : VulkanRenderer(window, scene, config), m_raytracer(scene, m_width, m_height)
 {
-	uint32_t width = scene->camera.resolution.x;
-	uint32_t height = scene->camera.resolution.y;
-	uint32_t sizeX = width / 4;
-	uint32_t startX = tileX * sizeX;
-	uint32_t endX = (tileX + 1) * sizeX;
-	endX = std::min(endX, width);
-
-	uint32_t sizeY = height / 4;
-	uint32_t startY = tileY * sizeY;
-	uint32_t endY = (tileY + 1) * sizeY;
-	endY = std::min(endY, height);
-
-	UniformSampler sampler(ESamples::X8);
-	for (uint32_t x = startX; x < endX; x++)
-	{
-		for (uint32_t y = startY; y < endY; y++)
-		{
-			vector<vec2> samples = sampler.Get2DSamples(vec2(x, y));
-
-			vec3 color;
-			float rayTraversalCost = 0.0f;
-			for (auto sample : samples)
-			{
-				Ray newRay = scene->camera.GenerateRay(sample.x, sample.y);
-				color += Raytrace(newRay, scene);
-				rayTraversalCost += newRay.m_traversalCost;
-
-			}
-
-			color /= samples.size();
+	auto it = m_config->find("CPU_FRAME_BUDGET_MS");
+	if (it != m_config->end()) {
+		m_raytracer.SetFrameBudget(std::stof(it->second));
+	}
 
-			rayTraversalCost /= samples.size();
-			vec3 costColor = vec3(0, 0, 0);
-			costColor.r = rayTraversalCost / 20.0f;
-			costColor.g = std::max((10.0f - rayTraversalCost) / 20.0f, 0.0f);
-			//color = costColor;
+	it = m_config->find("CPU_MAX_SAMPLES");
+	if (it != m_config->end()) {
+		m_raytracer.SetMaxSamples(std::stoul(it->second));
+	}
 
-			color = glm::clamp(color * 255.0f, 0.f, 255.f);
-			film->SetPixel(x, y, glm::vec4(color, 1));
-		}
+	it = m_config->find("VISUALIZE_RAY_COST");
+	if (it != m_config->end()) {
+		m_raytracer.SetVisualizeRayCost(it->second.compare("true") == 0);
 	}
-}
 
+	it = m_config->find("CPU_WAVEFRONT");
+	if (it != m_config->end()) {
+		m_raytracer.SetWavefront(it->second.compare("true") == 0);
+	}
 
-VulkanCPURaytracer::VulkanCPURaytracer(
-	GLFWwindow* window, 
-	Scene* scene,
-	std::shared_ptr<std::map<string, string>> config
-	) : VulkanRenderer(window, scene, config), m_film{Film(m_width, m_height)}
-{
 	Prepare();
 }
 
@@ -179,39 +76,11 @@ VulkanCPURaytracer::Render() {
 
 	VulkanRenderer::Render();
 
-	m_film.Clear();
-
 	VkDeviceSize imageSize = m_width * m_height * 4;
 	
-	static int profileCount = 0;
-	static auto startTime = std::chrono::high_resolution_clock::now();
-#ifdef MULTITHREAD
-	// Generate 4x4 threads
-	for (int i = 0; i < 16; i++)
-	{
-		m_threads[i] = std::thread(Task, i / 4, i % 4, m_scene, &m_film, m_raysQueue);
-	}
-	for (int i = 0; i < 16; i++)
-	{
-		m_threads[i].join();
-	}
-#else
-	for (int w = 0; w < m_width; w++)
-	{
-		for (int h = 0; h < m_height; h++)
-		{
-			Raytrace(w, h, m_scene, &m_film);
-		}
-	}
-#endif
-	if (++profileCount >= 100) {
-		profileCount = 0;
-		auto endTime = std::chrono::high_resolution_clock::now();
-		float ms = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
-		ms /= 100.0f;
-		startTime = endTime;
-		std::cout << ms << std::endl;
-	}
+	m_raytracer.RenderFrame();
+
+	PROFILE_SCOPE("VulkanCPURaytracer::UploadFilm");
 
 	m_vulkanDevice->TransitionImageLayout(
 		m_graphics.queue,
@@ -235,7 +104,7 @@ VulkanCPURaytracer::Render() {
 	void* data;
 	vkMapMemory(m_vulkanDevice->device, m_stagingImage.imageMemory, 0, imageSize, 0, &data);
 
-	memcpy(data, m_film.GetData().data(), imageSize);
+	memcpy(data, m_raytracer.GetFilm().GetData().data(), imageSize);
 
 	vkUnmapMemory(m_vulkanDevice->device, m_stagingImage.imageMemory);
 
@@ -927,24 +796,9 @@ void VulkanCPURaytracer::PrepareTextures() {
 
 	GenerateWireframeBVHNodes();
 
-	m_logger->info("Number of threads available: {0}\n", std::thread::hardware_concurrency());
+	m_logger->info("Number of render threads: {0}\n", m_raytracer.GetNumThreads());
 
-#ifdef MULTITHREAD
-	// Generate 4x4 threads
-	for (int i = 0; i < 16; i++) {
-		m_threads[i] = std::thread(Task, i / 4, i % 4, m_scene, &m_film, m_raysQueue);
-	}
-	for (int i = 0; i < 16; i++)
-	{
-		m_threads[i].join();
-	}
-#else
-	for (int w = 0; w < m_width; w++) {
-		for (int h = 0; h < m_height; h++) {
-			Raytrace(w, h, m_scene, &m_film);
-		}
-	}
-#endif
+	m_raytracer.RenderFrame();
 
 
 	VkDeviceSize imageSize = m_width * m_height * 4;
@@ -972,7 +826,7 @@ void VulkanCPURaytracer::PrepareTextures() {
 	void* data;
 	vkMapMemory(m_vulkanDevice->device, m_stagingImage.imageMemory, 0, imageSize, 0, &data);
 
-	memcpy(data, m_film.GetData().data(), imageSize);
+	memcpy(data, m_raytracer.GetFilm().GetData().data(), imageSize);
 
 	vkUnmapMemory(m_vulkanDevice->device, m_stagingImage.imageMemory);
 
@@ -1,9 +1,7 @@
  #pragma once
 #include "VulkanRenderer.h"
 #include "VulkanBuffer.h"
-#include "renderer/Film.h"
-#include <thread>
-#include <queue>
+#include "renderer/CPURaytracer.h"
 
 class VulkanCPURaytracer : public VulkanRenderer
 {
@@ -80,10 +78,7 @@ protected:
 	VkPipelineLayout m_wireframePipelineLayout;
 	uint32_t m_wireframeIndexCount;
 
-	Film m_film;
-
-	std::array<std::thread, 16> m_threads;
-	queue<Ray> m_raysQueue;
+	CPURaytracer m_raytracer;
 
 	void
 	GenerateWireframeBVHNodes();
@@ -779,7 +779,11 @@ void
 VulkanGPURaytracer::PrepareComputeRaytraceStorageBuffer() {
 	// =========== INDICES
 	VulkanBuffer::StorageBuffer stagingBuffer;
-	VkDeviceSize bufferSize = m_scene->indices.size() * sizeof(ivec4);
+	std::vector<ivec4> triangles;
+	std::vector<glm::vec4> positions;
+	std::vector<glm::vec4> normals;
+	m_scene->FlattenForGPU(triangles, positions, normals);
+	VkDeviceSize bufferSize = triangles.size() * sizeof(ivec4);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
@@ -791,7 +795,7 @@ VulkanGPURaytracer::PrepareComputeRaytraceStorageBuffer() {
 	);
 
 	m_vulkanDevice->MapMemory(
-		m_scene->indices.data(),
+		triangles.data(),
 		stagingBuffer.memory,
 		bufferSize,
 		0
@@ -823,7 +827,7 @@ VulkanGPURaytracer::PrepareComputeRaytraceStorageBuffer() {
 	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
 
 	// =========== VERTICE POSITIONS
-	bufferSize = m_scene->verticePositions.size() * sizeof(glm::vec4);
+	bufferSize = positions.size() * sizeof(glm::vec4);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
@@ -835,7 +839,7 @@ VulkanGPURaytracer::PrepareComputeRaytraceStorageBuffer() {
 	);
 
 	m_vulkanDevice->MapMemory(
-		m_scene->verticePositions.data(),
+		positions.data(),
 		stagingBuffer.memory,
 		bufferSize,
 		0
@@ -867,7 +871,7 @@ VulkanGPURaytracer::PrepareComputeRaytraceStorageBuffer() {
 	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
 
 	// =========== VERTICE NORMALS
-	bufferSize = m_scene->verticeNormals.size() * sizeof(glm::vec4);
+	bufferSize = normals.size() * sizeof(glm::vec4);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
@@ -879,7 +883,7 @@ VulkanGPURaytracer::PrepareComputeRaytraceStorageBuffer() {
 	);
 
 	m_vulkanDevice->MapMemory(
-		m_scene->verticeNormals.data(),
+		normals.data(),
 		stagingBuffer.memory,
 		bufferSize,
 		0
@@ -926,7 +926,11 @@ void
 VulkanHybridRenderer::PrepareComputeRaytraceStorageBuffer() {
 	// =========== INDICES
 	VulkanBuffer::StorageBuffer stagingBuffer;
-	VkDeviceSize bufferSize = m_scene->indices.size() * sizeof(ivec4);
+	std::vector<ivec4> triangles;
+	std::vector<glm::vec4> positions;
+	std::vector<glm::vec4> normals;
+	m_scene->FlattenForGPU(triangles, positions, normals);
+	VkDeviceSize bufferSize = triangles.size() * sizeof(ivec4);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
@@ -938,7 +942,7 @@ VulkanHybridRenderer::PrepareComputeRaytraceStorageBuffer() {
 	);
 
 	m_vulkanDevice->MapMemory(
-		m_scene->indices.data(),
+		triangles.data(),
 		stagingBuffer.memory,
 		bufferSize,
 		0
@@ -970,7 +974,7 @@ VulkanHybridRenderer::PrepareComputeRaytraceStorageBuffer() {
 	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
 
 	// =========== VERTICE POSITIONS
-	bufferSize = m_scene->verticePositions.size() * sizeof(glm::vec4);
+	bufferSize = positions.size() * sizeof(glm::vec4);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
@@ -982,7 +986,7 @@ VulkanHybridRenderer::PrepareComputeRaytraceStorageBuffer() {
 	);
 
 	m_vulkanDevice->MapMemory(
-		m_scene->verticePositions.data(),
+		positions.data(),
 		stagingBuffer.memory,
 		bufferSize,
 		0
@@ -1014,7 +1018,7 @@ VulkanHybridRenderer::PrepareComputeRaytraceStorageBuffer() {
 	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
 
 	// =========== VERTICE NORMALS
-	bufferSize = m_scene->verticeNormals.size() * sizeof(glm::vec4);
+	bufferSize = normals.size() * sizeof(glm::vec4);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
@@ -1026,7 +1030,7 @@ VulkanHybridRenderer::PrepareComputeRaytraceStorageBuffer() {
 	);
 
 	m_vulkanDevice->MapMemory(
-		m_scene->verticeNormals.data(),
+		normals.data(),
 		stagingBuffer.memory,
 		bufferSize,
 		0
@@ -9,6 +9,7 @@
 
 #include "VulkanRenderer.h"
 #include "Utilities.h"
+#include "Profiler.h"
 #include "VulkanImage.h"
 #include "VulkanBuffer.h"
 
@@ -341,6 +342,14 @@ VulkanRenderer::PrepareGraphicsPipeline() {
 	// 9. Create pipeline layout to hold uniforms. This can be modified dynamically. 
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = MakePipelineLayoutCreateInfo(&m_graphics.descriptorSetLayout);
 	pipelineLayoutCreateInfo.pSetLayouts = &m_graphics.descriptorSetLayout;
+
+	// Instance transforms are pushed per draw
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(GraphicsPushConstants);
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 	CheckVulkanResult(
 		vkCreatePipelineLayout(m_vulkanDevice->device, &pipelineLayoutCreateInfo, nullptr, &m_graphics.pipelineLayout),
 		"Failed to create pipeline layout."
@@ -582,20 +591,32 @@ VulkanRenderer::PrepareCommandPool() {
 VkResult
 VulkanRenderer::PrepareVertexBuffers() {
 	m_graphics.geometryBuffers.clear();
+	m_graphics.geometryIndexCounts.clear();
+	m_graphics.geometryInstances.clear();
+
+	// Each primitive is uploaded once. Baked ones are drawn as they are, instanced ones once per instance
+	// with its transform pushed to the vertex shader.
+	std::vector<std::vector<glm::mat4>> transforms(m_scene->meshesData.size());
+	for (const MeshInstance& instance : m_scene->instances) {
+		for (size_t m = instance.firstMesh; m < instance.firstMesh + instance.numMeshes; ++m) {
+			transforms[m].push_back(instance.transform);
+		}
+	}
 
-	for (MeshData* geomData : m_scene->meshesData) {
+	for (size_t m = 0; m < m_scene->meshesData.size(); ++m) {
+		const MeshData* geomData = m_scene->meshesData[m];
 		VulkanBuffer::GeometryBuffer geomBuffer;
 
 		// ----------- Vertex attributes --------------
 
-		std::vector<Byte>& indexData = geomData->vertexData.at(INDEX);
-		VkDeviceSize indexBufferSize = sizeof(indexData[0]) * indexData.size();
+		// The loader keeps no per mesh copy, the staging buffer is filled from the scene arrays
+		size_t indexCount = geomData->attribInfo.at(INDEX).count / 3 * 3;
+		size_t vertexCount = geomData->attribInfo.at(POSITION).count;
+		VkDeviceSize indexBufferSize = sizeof(uint32_t) * indexCount;
 		VkDeviceSize indexBufferOffset = 0;
-		std::vector<Byte>& positionData = geomData->vertexData.at(POSITION);
-		VkDeviceSize positionBufferSize = sizeof(positionData[0]) * positionData.size();
+		VkDeviceSize positionBufferSize = sizeof(glm::vec3) * vertexCount;
 		VkDeviceSize positionBufferOffset = indexBufferSize;
-		std::vector<Byte>& normalData = geomData->vertexData.at(NORMAL);
-		VkDeviceSize normalBufferSize = sizeof(normalData[0]) * normalData.size();
+		VkDeviceSize normalBufferSize = sizeof(glm::vec3) * vertexCount;
 		VkDeviceSize normalBufferOffset = positionBufferOffset + positionBufferSize;
 
 		VkDeviceSize bufferSize = indexBufferSize + positionBufferSize + normalBufferSize;
@@ -630,9 +651,13 @@ VulkanRenderer::PrepareVertexBuffers() {
 		// Filling the stage buffer with data
 		void* data;
 		vkMapMemory(m_vulkanDevice->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, indexData.data(), static_cast<size_t>(indexBufferSize));
-		memcpy((Byte*)data + positionBufferOffset, positionData.data(), static_cast<size_t>(positionBufferSize));
-		memcpy((Byte*)data + normalBufferOffset, normalData.data(), static_cast<size_t>(normalBufferSize));
+		memcpy(data, m_scene->indices.data() + 3 * geomData->firstTriangle, indexBufferSize);
+		glm::vec3* positions = reinterpret_cast<glm::vec3*>((Byte*)data + positionBufferOffset);
+		glm::vec3* normals = reinterpret_cast<glm::vec3*>((Byte*)data + normalBufferOffset);
+		for (size_t v = 0; v < vertexCount; ++v) {
+			positions[v] = glm::vec3(m_scene->verticePositions[geomData->firstVertex + v]);
+			normals[v] = glm::vec3(m_scene->verticeNormals[geomData->firstVertex + v]);
+		}
 		vkUnmapMemory(m_vulkanDevice->device, stagingBufferMemory);
 
 		// -----------------------------------------
@@ -667,6 +692,11 @@ VulkanRenderer::PrepareVertexBuffers() {
 		vkFreeMemory(m_vulkanDevice->device, stagingBufferMemory, nullptr);
 
 		m_graphics.geometryBuffers.push_back(geomBuffer);
+		m_graphics.geometryIndexCounts.push_back(static_cast<uint32_t>(indexCount));
+		if (transforms[m].empty()) {
+			transforms[m].push_back(glm::mat4(1.0f));
+		}
+		m_graphics.geometryInstances.push_back(transforms[m]);
 	}
 	return VK_SUCCESS;
 }
@@ -804,13 +834,19 @@ VulkanRenderer::BuildCommandBuffers() {
 			vkCmdBindVertexBuffers(m_graphics.commandBuffers[i], 0, 2, vertexBuffers, offsets);
 
 			// Bind index buffer
-			vkCmdBindIndexBuffer(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.bufferLayout.vertexBufferOffsets.at(INDEX), VK_INDEX_TYPE_UINT16);
+			vkCmdBindIndexBuffer(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.bufferLayout.vertexBufferOffsets.at(INDEX), VK_INDEX_TYPE_UINT32);
 
 			// Bind uniform buffer
 			vkCmdBindDescriptorSets(m_graphics.commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics.pipelineLayout, 0, 1, &m_graphics.descriptorSets, 0, nullptr);
 
-			// Record draw command for the triangle!
-			vkCmdDrawIndexed(m_graphics.commandBuffers[i], m_scene->meshesData[b]->attribInfo.at(INDEX).count, 1, 0, 0, 0);
+			// Record draw command for the triangle! Once per instance of the primitive
+			for (const glm::mat4& transform : m_graphics.geometryInstances[b]) {
+				GraphicsPushConstants pushConstants;
+				pushConstants.instance = transform;
+				pushConstants.instanceNormal = glm::mat4(glm::transpose(glm::inverse(glm::mat3(transform))));
+				vkCmdPushConstants(m_graphics.commandBuffers[i], m_graphics.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GraphicsPushConstants), &pushConstants);
+				vkCmdDrawIndexed(m_graphics.commandBuffers[i], m_graphics.geometryIndexCounts[b], 1, 0, 0, 0);
+			}
 		}
 
 		// Record end renderpass
@@ -913,14 +949,17 @@ void
 VulkanRenderer::Render() {
 	// Acquire the swapchain
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(
-		m_vulkanDevice->device,
-		m_vulkanDevice->m_swapchain.swapchain,
-		UINT64_MAX, // Timeout
-		m_imageAvailableSemaphore,
-		VK_NULL_HANDLE,
-		&imageIndex
-	);
+	{
+		PROFILE_SCOPE("VulkanRenderer::AcquireImage");
+		vkAcquireNextImageKHR(
+			m_vulkanDevice->device,
+			m_vulkanDevice->m_swapchain.swapchain,
+			UINT64_MAX, // Timeout
+			m_imageAvailableSemaphore,
+			VK_NULL_HANDLE,
+			&imageIndex
+		);
+	}
 
 	// Submit command buffers
 	std::vector<VkSemaphore> waitSemaphores = {m_imageAvailableSemaphore};
@@ -934,6 +973,7 @@ VulkanRenderer::Render() {
 	);
 
 	// Submit to queue
+	PROFILE_SCOPE("VulkanRenderer::SubmitAndPresent");
 	CheckVulkanResult(
 		vkQueueSubmit(m_graphics.queue, 1, &submitInfo, VK_NULL_HANDLE),
 		"Failed to submit queue"
@@ -26,6 +26,12 @@ struct GraphicsUniformBufferObject {
 	glm::mat4 proj;
 };
 
+// Per draw transform of an instanced mesh, the vertex shader applies it before ubo.model
+struct GraphicsPushConstants {
+	glm::mat4 instance;
+	glm::mat4 instanceNormal;
+};
+
 // ===================
 // VULKAN RENDERER
 // ===================
@@ -148,6 +154,8 @@ protected:
 		VkRenderPass renderPass;
 
 		std::vector<VulkanBuffer::GeometryBuffer> geometryBuffers;
+		std::vector<uint32_t> geometryIndexCounts; // Per geometry buffer
+		std::vector<std::vector<glm::mat4>> geometryInstances; // Per geometry buffer, one draw per transform
 
 		/**
 		* \brief Uniform buffers
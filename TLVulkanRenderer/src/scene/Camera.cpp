@@ -63,6 +63,16 @@ Camera::RecomputeAttributes() {
 			(float)resolution.y
 		);
 	}
+
+	// Ray generation only needs the camera to world basis, it's inverted once here rather than per ray
+	glm::mat4 cameraToWorld = glm::inverse(viewMat);
+	lensAxisX = glm::vec3(cameraToWorld[0]);
+	lensAxisY = glm::vec3(cameraToWorld[1]);
+	glm::vec3 axisZ = glm::vec3(cameraToWorld[2]);
+	float tanHalfFovY = tan(fov / 2.0f);
+	rayDirDx = lensAxisX * (2.0f * tanHalfFovY * aspect / resolution.x);
+	rayDirDy = lensAxisY * (-2.0f * tanHalfFovY / resolution.y);
+	rayDirOrigin = lensAxisX * (-tanHalfFovY * aspect) + lensAxisY * tanHalfFovY - axisZ;
 }
 
 glm::mat4
@@ -134,15 +144,54 @@ Camera::TranslateAlongUp(
 	RecomputeAttributes();
 }
 
+/**
+ * \brief Maps the unit square onto the unit disk, keeping stratified samples stratified (Shirley and Chiu)
+ */
+static glm::vec2 ConcentricSampleDisk(const glm::vec2& sample) {
+	glm::vec2 offset = 2.0f * sample - glm::vec2(1.0f);
+	if (offset.x == 0 && offset.y == 0) {
+		return glm::vec2(0);
+	}
+
+	float radius, theta;
+	if (std::abs(offset.x) > std::abs(offset.y)) {
+		radius = offset.x;
+		theta = (PI / 4.0f) * (offset.y / offset.x);
+	} else {
+		radius = offset.y;
+		theta = (PI / 2.0f) - (PI / 4.0f) * (offset.x / offset.y);
+	}
+	return radius * glm::vec2(std::cos(theta), std::sin(theta));
+}
+
 Ray Camera::GenerateRay(float x, float y) const {
+	return Ray(eye, glm::normalize(rayDirOrigin + x * rayDirDx + y * rayDirDy));
+}
+
+Ray Camera::GenerateRay(float x, float y, const glm::vec2& lensSample) const {
+	glm::vec3 direction = rayDirOrigin + x * rayDirDx + y * rayDirDy;
+	return lensRadius > 0 ? GenerateLensRay(direction, lensSample) : Ray(eye, glm::normalize(direction));
+}
 
-	float tan_fovy = tan(fov / 2.0f);
-	float pixelNDCx = (2.0f * (float(x) / float(resolution.x)) - 1.0f);
-	float pixelNDCy = (1.0f - 2.0f * (float(y) / float(resolution.y)));
-	float px = pixelNDCx * tan_fovy * aspect;
-	float py = pixelNDCy * tan_fovy;
-	vec3 P = vec3(px, py, -1);
-	P = glm::inverse(viewMat) * (vec4(P, 1.0f));
+void Camera::GenerateRayRow(
+	float x,
+	float y,
+	uint32_t numRays,
+	Ray* rays,
+	const glm::vec2* lensSamples
+) const {
+	glm::vec3 rowStart = rayDirOrigin + x * rayDirDx + y * rayDirDy;
+	bool hasLens = lensRadius > 0 && lensSamples != nullptr;
+	for (uint32_t i = 0; i < numRays; i++) {
+		glm::vec3 direction = rowStart + float(i) * rayDirDx;
+		rays[i] = hasLens ? GenerateLensRay(direction, lensSamples[i]) : Ray(eye, glm::normalize(direction));
+	}
+}
 
-	return Ray(eye, normalize(P - eye));
+Ray Camera::GenerateLensRay(const glm::vec3& direction, const glm::vec2& lensSample) const {
+	// Rays through the same film position all meet on the plane in focus
+	glm::vec3 focusPoint = eye + focalDistance * direction;
+	glm::vec2 lensPoint = lensRadius * ConcentricSampleDisk(lensSample);
+	glm::vec3 origin = eye + lensPoint.x * lensAxisX + lensPoint.y * lensAxisY;
+	return Ray(origin, glm::normalize(focusPoint - origin));
 }
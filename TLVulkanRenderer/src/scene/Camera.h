@@ -21,8 +21,29 @@ struct Camera {
 	void Zoom(float amount);
 	void TranslateAlongRight(float amount);
 	void TranslateAlongUp(float amount);
+
+	// -- Ray generation, film positions are in pixels
 	Ray GenerateRay(float x, float y) const;
 
+	/**
+	 * \brief Thin lens ray through film position (x, y)
+	 * \param lensSample : uniform in [0, 1)^2, picks the point on the aperture. Pinhole cameras ignore it.
+	 */
+	Ray GenerateRay(float x, float y, const glm::vec2& lensSample) const;
+
+	/**
+	 * \brief Rays through (x, y), (x + 1, y) ... (x + numRays - 1, y). Directions step by the cached
+	 * per pixel delta, no matrix is involved.
+	 * \param lensSamples : one per ray, nullptr for rays through the center of the lens
+	 */
+	void GenerateRayRow(
+		float x,
+		float y,
+		uint32_t numRays,
+		Ray* rays,
+		const glm::vec2* lensSamples = nullptr
+	) const;
+
 	// -- Attributes
 	glm::ivec2 resolution;
 	float fov;
@@ -40,4 +61,21 @@ struct Camera {
 	glm::mat4 viewMat;
 	glm::mat4 projMat;
 	bool isPerspective = true;
+
+	// Thin lens, 0 keeps the pinhole camera
+	float lensRadius = 0.0f;
+	// Distance along the view direction to the plane in focus
+	float focalDistance = 1.0f;
+
+	// Cached by RecomputeAttributes: the direction through film position (x, y), before normalization, is
+	// rayDirOrigin + x * rayDirDx + y * rayDirDy. Its component along the view direction is always 1.
+	glm::vec3 rayDirOrigin;
+	glm::vec3 rayDirDx;
+	glm::vec3 rayDirDy;
+	// Camera space x and y axes in world space, they span the aperture
+	glm::vec3 lensAxisX;
+	glm::vec3 lensAxisY;
+
+private:
+	Ray GenerateLensRay(const glm::vec3& direction, const glm::vec2& lensSample) const;
 };
@@ -1,15 +1,24 @@
 #include "Scene.h"
 #include "lights/PointLight.h"
 #include "sceneLoaders/gltfLoader.h"
+#include "SceneCache.h"
+#include <algorithm>
 #include <iostream>
+#include <chrono>
 #include "accel/SBVH.h"
+#include "accel/QBVH.h"
+#include "accel/Instance.h"
+#include "Profiler.h"
 #include "geometry/materials/MetalMaterial.h"
 #include "geometry/materials/GlassMaterial.h"
 
 Scene::Scene(
 	std::string fileName,
 	std::map<std::string, std::string>& config	
-) : m_useAccel(false) 
+) : m_useAccel(false),
+	m_useSceneCache(false),
+	m_useQBVH(false),
+	m_recordAccelStats(false)
 {
 	m_sceneLoader.reset(new gltfLoader());
 
@@ -17,15 +26,35 @@ Scene::Scene(
 	if (config.find("USE_SBVH") != config.end()) {
 		m_useAccel = config["USE_SBVH"].compare("true") == 0;
 	}
+	if (config.find("SCENE_CACHE") != config.end()) {
+		m_useSceneCache = config["SCENE_CACHE"].compare("true") == 0;
+	}
+
+	m_useQBVH = config.find("ACCEL_STRUCTURE") != config.end() && config["ACCEL_STRUCTURE"].compare("QBVH") == 0;
+
+	// Only the heat map and the profiler read traversal stats, other renders use the kernels without them
+	bool visualizeRayCost = config.find("VISUALIZE_RAY_COST") != config.end() && config["VISUALIZE_RAY_COST"].compare("true") == 0;
+	m_recordAccelStats = visualizeRayCost || Profiler::IsEnabled();
+
+	m_accel = CreateAccelStructure();
+
+	// A structure that can't be serialised can't be cached either
+	if (m_useAccel && m_accel->GetCacheKey().empty()) {
+		m_useSceneCache = false;
+	}
 
-	// Construct SBVH
-	m_accel.reset(new SBVH(
-		100,
-		SBVH::Spatial
-		));
+	SceneCache cache(fileName, m_useAccel ? m_accel->GetCacheKey() : "No acceleration structure");
+	bool isGeometryCached = m_useSceneCache && cache.Load(this);
+	if (!isGeometryCached) {
+		ParseSceneFile(fileName);
+	}
 
-	ParseSceneFile(fileName);
 	PrepareTestScene();
+	bool isAccelCached = BuildAccelStructure(isGeometryCached ? &cache : nullptr);
+
+	if (m_useSceneCache && !(isGeometryCached && isAccelCached)) {
+		cache.Save(*this, m_useAccel ? m_accel.get() : nullptr);
+	}
 }
 
 
@@ -48,6 +77,36 @@ Scene::~Scene() {
 	m_accel->Destroy();
 }
 
+std::unique_ptr<AccelStructure> Scene::CreateAccelStructure() const
+{
+	// The 4-wide QBVH is collapsed from the same SBVH build
+	std::unique_ptr<AccelStructure> accel;
+	if (m_useQBVH) {
+		accel.reset(new QBVH(
+			100,
+			SBVH::Spatial
+			));
+	} else {
+		accel.reset(new SBVH(
+			100,
+			SBVH::Spatial
+			));
+	}
+	accel->SetRecordStats(m_recordAccelStats);
+	return accel;
+}
+
+size_t Scene::GetAccelMemoryFootprint() const
+{
+	size_t bytes = m_accel->GetMemoryFootprint();
+	for (auto& bottomLevel : bottomLevelAccels) {
+		if (bottomLevel->accel) {
+			bytes += bottomLevel->accel->GetMemoryFootprint();
+		}
+	}
+	return bytes;
+}
+
 void Scene::ParseSceneFile(std::string fileName)
 {
 	m_sceneLoader->Load(fileName, this);
@@ -65,7 +124,8 @@ Scene::GetIntersection(Ray& ray)
 		Intersection nearestIsx;
 		for (auto geo : geometries)
 		{
-			Intersection isx = geo->GetIntersection(ray);
+			GeometryQuery query(nearestT, TriangleRef());
+			Intersection isx = geo->GetIntersection(ray, query);
 			if (isx.t > 0 && isx.t < nearestT)
 			{
 				nearestT = isx.t;
@@ -78,16 +138,39 @@ Scene::GetIntersection(Ray& ray)
 }
 
 bool 
-Scene::DoesIntersect(Ray& ray) 
+Scene::DoesIntersect(Ray& ray, float tMax) 
+{
+	if (m_useAccel) {
+		return m_accel->DoesIntersect(ray, tMax);
+	} else {
+		// Loop through all objects and find any intersection before tMax
+		for (auto geo : geometries)
+		{
+			if (geo->DoesIntersect(ray, tMax))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+bool
+Scene::DoesIntersect(Ray& ray, float tMax, const TriangleRef& excludeTriangle)
 {
 	if (m_useAccel) {
-		return m_accel->DoesIntersect(ray);
+		return m_accel->DoesIntersect(ray, tMax, excludeTriangle);
 	} else {
-		// Loop through all objects and find any intersection
+		// Only triangles are excluded, same as the acceleration structures' triangle filter
 		for (auto geo : geometries)
 		{
-			Intersection isx = geo->GetIntersection(ray);
-			if (isx.t > 0)
+			if (geo.get() == excludeTriangle.triangle && dynamic_cast<Triangle*>(geo.get()) != nullptr)
+			{
+				continue;
+			}
+
+			GeometryQuery query(tMax, excludeTriangle);
+			if (geo->DoesIntersect(ray, query))
 			{
 				return true;
 			}
@@ -96,6 +179,32 @@ Scene::DoesIntersect(Ray& ray)
 	}
 }
 
+void
+Scene::GetIntersectionPacket(Ray* rays, uint32_t numRays, Intersection* isxs)
+{
+	if (m_useAccel) {
+		m_accel->GetIntersectionPacket(rays, numRays, isxs);
+	} else {
+		for (uint32_t i = 0; i < numRays; i++)
+		{
+			isxs[i] = GetIntersection(rays[i]);
+		}
+	}
+}
+
+void
+Scene::DoesIntersectPacket(Ray* rays, uint32_t numRays, const float* tMax, const TriangleRef* excludeTriangles, bool* occluded)
+{
+	if (m_useAccel) {
+		m_accel->DoesIntersectPacket(rays, numRays, tMax, excludeTriangles, occluded);
+	} else {
+		for (uint32_t i = 0; i < numRays; i++)
+		{
+			occluded[i] = DoesIntersect(rays[i], tMax[i], excludeTriangles[i]);
+		}
+	}
+}
+
 void Scene::PrepareTestScene()
 {
 	static const Point3 TRUCK_EYE(4.548, 4.427, 13.23);
@@ -122,18 +231,50 @@ void Scene::PrepareTestScene()
 	}
 
 
+	// Instanced meshes go to their bottom level structure rather than to geometries
+	std::vector<bool> isInstanced(meshes.size(), false);
+	for (const MeshInstance& instance : instances) {
+		std::fill(isInstanced.begin() + instance.firstMesh, isInstanced.begin() + instance.firstMesh + instance.numMeshes, true);
+	}
+
 	// Turn meshes into triangles
 	for (int m = 0; m < meshes.size(); m++)
 	{
 		//meshes[m].SetTransform(Transform(glm::vec3(0, 0, 0), glm::vec3(0), glm::vec3(1, 1, 1)));
 		for (int t = 0; t < meshes[m].triangles.size(); t++)
 		{
-			std::string name = "triangle" + t;
+			std::string name = "triangle" + std::to_string(t);
 			meshes[m].triangles[t].SetName(name);
-			geometries.push_back(std::shared_ptr<Geometry>(&meshes[m].triangles[t]));
+			if (isInstanced[m]) {
+				continue;
+			}
+			// The mesh owns its triangles, the shared pointer must not delete them
+			geometries.push_back(std::shared_ptr<Geometry>(&meshes[m].triangles[t], [](Geometry*) {}));
 		}
 	}
 
+	// One bottom level structure per instanced mesh, shared by all of its instances
+	std::map<size_t, std::shared_ptr<BottomLevelAccel>> bottomLevelByMesh;
+	for (size_t i = 0; i < instances.size(); i++) {
+		const MeshInstance& instance = instances[i];
+		std::shared_ptr<BottomLevelAccel>& bottomLevel = bottomLevelByMesh[instance.firstMesh];
+		if (!bottomLevel) {
+			bottomLevel.reset(new BottomLevelAccel());
+			for (size_t m = instance.firstMesh; m < instance.firstMesh + instance.numMeshes; m++) {
+				for (Triangle& triangle : meshes[m].triangles) {
+					bottomLevel->geometries.push_back(std::shared_ptr<Geometry>(&triangle, [](Geometry*) {}));
+					bottomLevel->bounds = BBox::BBoxUnion(bottomLevel->bounds, triangle.GetBBox());
+				}
+			}
+			bottomLevelAccels.push_back(bottomLevel);
+		}
+
+		std::shared_ptr<Instance> geo(new Instance(bottomLevel, instance.transform));
+		std::string name = "instance" + std::to_string(i);
+		geo->SetName(name);
+		geometries.push_back(geo);
+	}
+
 	// Add buildings
 	std::shared_ptr<Cube> road(new Cube(vec3(0, -0.5, -1), vec3(30, 1, 10), lambertWhite));
 	road.get()->SetName(std::string("road"));
@@ -182,12 +323,127 @@ void Scene::PrepareTestScene()
 	//light = new PointLight(vec3(0, -2.1, 2), vec3(1, 2, 1), 10);
 	//lights.push_back(light);
 
-	if (m_useAccel)
-	{
+	std::cout << "Number of triangles: " << triangleMaterials.size() << std::endl;
+}
+
+bool Scene::BuildAccelStructure(SceneCache* cache)
+{
+	if (!m_useAccel) {
+		return true;
+	}
+
+	auto buildStart = std::chrono::high_resolution_clock::now();
+
+	// Bottom levels first, the cache stores them in this order before the top level
+	bool isCached = cache != nullptr;
+	for (auto& bottomLevel : bottomLevelAccels) {
+		bottomLevel->accel = CreateAccelStructure();
+		isCached = isCached && cache->LoadAccelStructure(bottomLevel->accel.get(), bottomLevel->geometries);
+		if (!isCached) {
+			bottomLevel->accel->Build(bottomLevel->geometries);
+		}
+	}
+
+	isCached = isCached && cache->LoadAccelStructure(m_accel.get(), geometries);
+	if (!isCached) {
 		m_accel->Build(geometries);
 	}
+	accelBuildSeconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - buildStart).count();
+	return isCached;
+}
+
+void Scene::BuildMeshTriangles(const MeshData& meshData, Mesh& mesh) const
+{
+	const size_t numTriangles = meshData.attribInfo.at(INDEX).count / 3;
+	const bool hasUVs = meshData.attribInfo.find(TEXCOORD) != meshData.attribInfo.end();
+	const size_t firstVertex = meshData.firstVertex;
+
+	mesh.triangles.reserve(numTriangles);
+	for (size_t t = meshData.firstTriangle; t < meshData.firstTriangle + numTriangles; ++t)
+	{
+		uvec3 idx(indices[3 * t], indices[3 * t + 1], indices[3 * t + 2]);
+		LambertMaterial* material = materials[triangleMaterials[t]];
+
+		if (!hasUVs) {
+			// No UVs
+			mesh.triangles.push_back(
+				Triangle(
+					verticePositions[idx.x + firstVertex],
+					verticePositions[idx.y + firstVertex],
+					verticePositions[idx.z + firstVertex],
+					verticeNormals[idx.x + firstVertex],
+					verticeNormals[idx.y + firstVertex],
+					verticeNormals[idx.z + firstVertex],
+					material
+				)
+			);
+		}
+		else
+		{
+			mesh.triangles.push_back(
+				Triangle(
+					verticePositions[idx.x + firstVertex],
+					verticePositions[idx.y + firstVertex],
+					verticePositions[idx.z + firstVertex],
+					verticeNormals[idx.x + firstVertex],
+					verticeNormals[idx.y + firstVertex],
+					verticeNormals[idx.z + firstVertex],
+					verticeUVs[idx.x + firstVertex],
+					verticeUVs[idx.y + firstVertex],
+					verticeUVs[idx.z + firstVertex],
+					material
+				)
+			);
+		}
+	}
+}
 
-	std::cout << "Number of triangles: " << indices.size() << std::endl;
+void Scene::FlattenForGPU(std::vector<glm::ivec4>& triangles, std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals) const
+{
+	// Baked primitives are copied as they are, instanced ones once per instance with its transform
+	std::vector<bool> isInstanced(meshesData.size(), false);
+	std::vector<std::pair<const MeshData*, glm::mat4>> copies;
+	for (const MeshInstance& instance : instances) {
+		std::fill(isInstanced.begin() + instance.firstMesh, isInstanced.begin() + instance.firstMesh + instance.numMeshes, true);
+	}
+	for (size_t m = 0; m < meshesData.size(); ++m) {
+		if (!isInstanced[m]) {
+			copies.push_back(std::make_pair(meshesData[m], glm::mat4(1.0f)));
+		}
+	}
+	for (const MeshInstance& instance : instances) {
+		for (size_t m = instance.firstMesh; m < instance.firstMesh + instance.numMeshes; ++m) {
+			copies.push_back(std::make_pair(meshesData[m], instance.transform));
+		}
+	}
+
+	triangles.clear();
+	positions.clear();
+	normals.clear();
+	for (auto& copy : copies) {
+		const MeshData* meshData = copy.first;
+		const glm::mat4& matrix = copy.second;
+		const glm::mat3 matrixNormal = glm::transpose(glm::inverse(glm::mat3(matrix)));
+		const size_t numTriangles = meshData->attribInfo.at(INDEX).count / 3;
+		const size_t numVertices = meshData->attribInfo.at(POSITION).count;
+		// The shaders index the vertex arrays directly, offset the primitive's indices to its copy
+		const int firstVertex = static_cast<int>(positions.size());
+
+		for (size_t t = meshData->firstTriangle; t < meshData->firstTriangle + numTriangles; ++t)
+		{
+			triangles.push_back(glm::ivec4(
+				firstVertex + indices[3 * t],
+				firstVertex + indices[3 * t + 1],
+				firstVertex + indices[3 * t + 2],
+				triangleMaterials[t]
+			));
+		}
+		for (size_t v = meshData->firstVertex; v < meshData->firstVertex + numVertices; ++v)
+		{
+			positions.push_back(glm::vec4(glm::vec3(matrix * verticePositions[v]), 1.0f));
+			normals.push_back(glm::vec4(glm::normalize(matrixNormal * glm::vec3(verticeNormals[v])), 0.0f));
+		}
+	}
 }
 
 void Scene::PrepareCornellBox() {
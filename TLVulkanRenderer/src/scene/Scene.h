@@ -8,6 +8,9 @@
 #include "lights/Light.h"
 #include "sceneLoaders/SceneLoader.h"
 
+class SceneCache;
+struct BottomLevelAccel;
+
 
 class Scene {
 public:
@@ -16,11 +19,23 @@ public:
 
 	void ParseSceneFile(std::string fileName);
 	Intersection GetIntersection(Ray& ray);
-	bool DoesIntersect(Ray& ray);
+	bool DoesIntersect(Ray& ray, float tMax);
+	// Occlusion query that ignores the triangle the ray leaves from, other geometry is never excluded
+	bool DoesIntersect(Ray& ray, float tMax, const TriangleRef& excludeTriangle);
+	// Packet versions of the queries above, see AccelStructure
+	void GetIntersectionPacket(Ray* rays, uint32_t numRays, Intersection* isxs);
+	void DoesIntersectPacket(Ray* rays, uint32_t numRays, const float* tMax, const TriangleRef* excludeTriangles, bool* occluded);
+	// Builds the triangles of one primitive from the shared arrays
+	void BuildMeshTriangles(const MeshData& meshData, Mesh& mesh) const;
+	// World space copy of every triangle for the compute shaders: indices into positions and normals with
+	// the triangle's material in w. Instanced meshes are copied once per instance with its transform.
+	void FlattenForGPU(std::vector<glm::ivec4>& triangles, std::vector<glm::vec4>& positions, std::vector<glm::vec4>& normals) const;
 
 	Camera camera;
 	
-	std::vector<glm::ivec4> indices;
+	// Three per triangle, relative to the primitive's firstVertex. Index buffers are uploaded straight from it.
+	std::vector<uint32_t> indices;
+	std::vector<int> triangleMaterials; // One per triangle
 	std::vector<glm::vec4> verticePositions;
 	std::vector<glm::vec4> verticeNormals;
 	std::vector<glm::vec2> verticeUVs;
@@ -33,13 +48,35 @@ public:
 	std::vector<Light*> lights;
 	std::unique_ptr<AccelStructure> m_accel;
 
+	// Meshes referenced by several glTF nodes. Their triangles are in object space and each instanced mesh
+	// gets its own structure in bottomLevelAccels, m_accel holds one Instance geometry per MeshInstance.
+	std::vector<MeshInstance> instances;
+	std::vector<std::shared_ptr<BottomLevelAccel>> bottomLevelAccels;
+
+	// Wall clock time spent building m_accel and bottomLevelAccels, or loading them from the scene cache
+	float accelBuildSeconds = 0;
+
+	// Bytes held by m_accel and bottomLevelAccels
+	size_t GetAccelMemoryFootprint() const;
+
+	// Files the scene was loaded from, the scene cache is dropped when any of them changes
+	std::vector<std::string> sourceFiles;
+
 
 private:
 
 	void PrepareTestScene();
+	// Restores m_accel and bottomLevelAccels from the cache if it has them, builds them otherwise. True if
+	// they were restored.
+	bool BuildAccelStructure(SceneCache* cache);
+	// Empty structure of the configured type, for the top level and every bottom level
+	std::unique_ptr<AccelStructure> CreateAccelStructure() const;
 	void PrepareCornellBox();
 
 	std::unique_ptr<SceneLoader> m_sceneLoader;	
 	bool m_useAccel;
+	bool m_useSceneCache;
+	bool m_useQBVH;
+	bool m_recordAccelStats;
 
 };
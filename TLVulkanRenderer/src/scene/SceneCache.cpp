@@ -0,0 +1,335 @@
+#include "SceneCache.h"
+#include "Scene.h"
+#include "BinaryStream.h"
+#include "accel/Instance.h"
+#include "Profiler.h"
+#include "renderer/ThreadPool.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+// Bump whenever the layout below, the loader's output or the scene's test geometry changes
+const uint32_t SCENE_CACHE_VERSION = 4;
+const uint32_t SCENE_CACHE_MAGIC = 0x43534c54; // "TLSC"
+
+/**
+ * \brief FNV-1a over 64 bit words, with an extra shift so high bits also reach the low ones. Fast enough to
+ * rehash every source file on each launch.
+ */
+static uint64_t
+HashBytes(
+	const Byte* data,
+	size_t size
+) {
+	const uint64_t prime = 1099511628211ull;
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ data[i]) * prime;
+	}
+	return hash;
+}
+
+SceneCache::SceneCache(
+	const std::string& sceneFile,
+	const std::string& accelKey
+) : m_cacheFile(sceneFile + ".tlcache"),
+	m_accelKeyHash(HashBytes(reinterpret_cast<const Byte*>(accelKey.data()), accelKey.size())),
+	m_accelOffset(0)
+{
+}
+
+bool SceneCache::Load(Scene* scene) {
+	PROFILE_SCOPE("SceneCache::Load");
+	if (!m_file.Open(m_cacheFile)) {
+		return false;
+	}
+
+	BinaryReader in(m_file.GetData(), m_file.GetSize());
+	uint32_t magic, version;
+	uint64_t accelKeyHash;
+	if (!in.Read(magic) || !in.Read(version) || !in.Read(accelKeyHash) ||
+		magic != SCENE_CACHE_MAGIC || version != SCENE_CACHE_VERSION || accelKeyHash != m_accelKeyHash) {
+		std::cout << "Scene cache " << m_cacheFile << " is out of date" << std::endl;
+		m_file.Close();
+		return false;
+	}
+
+	// -------- Source files -----------
+
+	uint64_t numSourceFiles;
+	std::vector<std::string> sourceFiles;
+	if (!in.Read(numSourceFiles)) {
+		m_file.Close();
+		return false;
+	}
+	for (uint64_t f = 0; f < numSourceFiles; f++) {
+		std::string fileName;
+		uint64_t size, hash;
+		if (!in.ReadString(fileName) || !in.Read(size) || !in.Read(hash)) {
+			m_file.Close();
+			return false;
+		}
+
+		MappedFile sourceFile;
+		if (!sourceFile.Open(fileName) || sourceFile.GetSize() != size || HashBytes(sourceFile.GetData(), sourceFile.GetSize()) != hash) {
+			std::cout << "Scene cache " << m_cacheFile << " is out of date, " << fileName << " changed" << std::endl;
+			m_file.Close();
+			return false;
+		}
+		sourceFiles.push_back(fileName);
+	}
+
+	// -------- Arrays -----------
+
+	std::vector<uint32_t> indices;
+	std::vector<int> triangleMaterials;
+	std::vector<glm::vec4> verticePositions;
+	std::vector<glm::vec4> verticeNormals;
+	std::vector<glm::vec2> verticeUVs;
+	std::vector<MaterialPacked> materialPackeds;
+	if (!in.ReadArray(indices) || !in.ReadArray(triangleMaterials) || !in.ReadArray(verticePositions) || !in.ReadArray(verticeNormals) ||
+		!in.ReadArray(verticeUVs) || !in.ReadArray(materialPackeds) || indices.size() != 3 * triangleMaterials.size()) {
+		m_file.Close();
+		return false;
+	}
+
+	// -------- Textures -----------
+
+	struct TextureData {
+		std::string name;
+		int32_t width;
+		int32_t height;
+		std::vector<unsigned char> data;
+	};
+	std::vector<TextureData> textures(materialPackeds.size());
+	std::vector<uint8_t> hasTextures(materialPackeds.size());
+	for (size_t m = 0; m < materialPackeds.size(); m++) {
+		if (!in.Read(hasTextures[m]) ||
+			(hasTextures[m] && (!in.ReadString(textures[m].name) || !in.Read(textures[m].width) || !in.Read(textures[m].height) || !in.ReadArray(textures[m].data)))) {
+			m_file.Close();
+			return false;
+		}
+	}
+
+	// -------- Primitives -----------
+
+	uint64_t numMeshes;
+	if (!in.Read(numMeshes) || numMeshes > m_file.GetSize()) {
+		m_file.Close();
+		return false;
+	}
+	std::vector<MeshData> meshesData(static_cast<size_t>(numMeshes));
+	for (MeshData& meshData : meshesData) {
+		uint64_t firstVertex, firstTriangle, numAttributes;
+		if (!in.Read(firstVertex) || !in.Read(firstTriangle) || !in.Read(numAttributes)) {
+			m_file.Close();
+			return false;
+		}
+		meshData.firstVertex = static_cast<size_t>(firstVertex);
+		meshData.firstTriangle = static_cast<size_t>(firstTriangle);
+
+		for (uint64_t a = 0; a < numAttributes; a++) {
+			int32_t attribute;
+			VertexAttributeInfo attributeInfo;
+			if (!in.Read(attribute) || !in.Read(attributeInfo)) {
+				m_file.Close();
+				return false;
+			}
+			meshData.attribInfo.insert(std::make_pair(static_cast<EVertexAttribute>(attribute), attributeInfo));
+		}
+
+		// Everything BuildMeshTriangles reads must be in range
+		auto indexInfo = meshData.attribInfo.find(INDEX);
+		auto positionInfo = meshData.attribInfo.find(POSITION);
+		if (indexInfo == meshData.attribInfo.end() || positionInfo == meshData.attribInfo.end() ||
+			meshData.firstTriangle + indexInfo->second.count / 3 > triangleMaterials.size() ||
+			meshData.firstVertex + positionInfo->second.count > verticePositions.size() ||
+			verticeNormals.size() != verticePositions.size() ||
+			(meshData.attribInfo.count(TEXCOORD) && verticeUVs.size() != verticePositions.size())) {
+			m_file.Close();
+			return false;
+		}
+		for (size_t t = meshData.firstTriangle; t < meshData.firstTriangle + indexInfo->second.count / 3; t++) {
+			if (std::max(indices[3 * t], std::max(indices[3 * t + 1], indices[3 * t + 2])) >= positionInfo->second.count ||
+				triangleMaterials[t] < 0 || static_cast<size_t>(triangleMaterials[t]) >= materialPackeds.size()) {
+				m_file.Close();
+				return false;
+			}
+		}
+	}
+
+	std::vector<MeshInstance> instances;
+	if (!in.ReadArray(instances)) {
+		m_file.Close();
+		return false;
+	}
+	for (const MeshInstance& instance : instances) {
+		if (instance.numMeshes == 0 || instance.firstMesh + instance.numMeshes > meshesData.size()) {
+			m_file.Close();
+			return false;
+		}
+	}
+
+	uint8_t hasAccel;
+	if (!in.Read(hasAccel)) {
+		m_file.Close();
+		return false;
+	}
+	m_accelOffset = hasAccel ? in.GetOffset() : 0;
+
+	// -------- Everything checked out, fill the scene -----------
+
+	scene->indices.swap(indices);
+	scene->triangleMaterials.swap(triangleMaterials);
+	scene->verticePositions.swap(verticePositions);
+	scene->verticeNormals.swap(verticeNormals);
+	scene->verticeUVs.swap(verticeUVs);
+	scene->materialPackeds.swap(materialPackeds);
+	scene->sourceFiles.swap(sourceFiles);
+	scene->instances.swap(instances);
+
+	for (size_t m = 0; m < scene->materialPackeds.size(); m++) {
+		Texture* texture = nullptr;
+		if (hasTextures[m]) {
+			texture = new ImageTexture(textures[m].name, textures[m].data, textures[m].width, textures[m].height);
+		}
+		scene->materials.push_back(new LambertMaterial(scene->materialPackeds[m], texture));
+	}
+
+	size_t firstMesh = scene->meshes.size();
+	scene->meshes.resize(firstMesh + meshesData.size());
+	for (const MeshData& meshData : meshesData) {
+		scene->meshesData.push_back(new MeshData(meshData));
+	}
+
+	{
+		ThreadPool threadPool(static_cast<uint32_t>(std::min<size_t>(meshesData.size(), std::thread::hardware_concurrency())));
+		threadPool.ParallelFor(static_cast<uint32_t>(meshesData.size()), [&](uint32_t index, uint32_t threadId) {
+			scene->BuildMeshTriangles(meshesData[index], scene->meshes[firstMesh + index]);
+		});
+	}
+
+	std::cout << "Loaded scene cache " << m_cacheFile << std::endl;
+	return true;
+}
+
+bool SceneCache::LoadAccelStructure(
+	AccelStructure* accel,
+	std::vector<std::shared_ptr<Geometry>>& geoms
+) {
+	if (!m_file.IsOpen() || m_accelOffset == 0) {
+		return false;
+	}
+
+	BinaryReader in(m_file.GetData(), m_file.GetSize());
+	in.SetOffset(m_accelOffset);
+	if (!accel->Deserialize(in, geoms)) {
+		m_accelOffset = 0;
+		return false;
+	}
+
+	// The next structure follows
+	m_accelOffset = in.GetOffset();
+	return true;
+}
+
+bool SceneCache::Save(
+	const Scene& scene,
+	const AccelStructure* accel
+) {
+	PROFILE_SCOPE("SceneCache::Save");
+	BinaryWriter out;
+	out.Write(SCENE_CACHE_MAGIC);
+	out.Write(SCENE_CACHE_VERSION);
+	out.Write(m_accelKeyHash);
+
+	// -------- Source files -----------
+
+	out.Write<uint64_t>(scene.sourceFiles.size());
+	for (const std::string& fileName : scene.sourceFiles) {
+		MappedFile sourceFile;
+		if (!sourceFile.Open(fileName)) {
+			return false;
+		}
+		out.WriteString(fileName);
+		out.Write<uint64_t>(sourceFile.GetSize());
+		out.Write(HashBytes(sourceFile.GetData(), sourceFile.GetSize()));
+	}
+
+	// -------- Arrays -----------
+
+	out.WriteArray(scene.indices);
+	out.WriteArray(scene.triangleMaterials);
+	out.WriteArray(scene.verticePositions);
+	out.WriteArray(scene.verticeNormals);
+	out.WriteArray(scene.verticeUVs);
+	out.WriteArray(scene.materialPackeds);
+
+	// -------- Textures -----------
+
+	// Only the loaded materials have a packed version, the test scene adds its own after them
+	for (size_t m = 0; m < scene.materialPackeds.size(); m++) {
+		const ImageTexture* texture = dynamic_cast<const ImageTexture*>(scene.materials[m]->m_texture);
+		if (scene.materials[m]->m_texture && texture == nullptr) {
+			return false;
+		}
+
+		out.Write<uint8_t>(texture != nullptr);
+		if (texture) {
+			out.WriteString(texture->GetName());
+			out.Write<int32_t>(texture->GetWidth());
+			out.Write<int32_t>(texture->GetHeight());
+			out.WriteArray(texture->GetData());
+		}
+	}
+
+	// -------- Primitives -----------
+
+	out.Write<uint64_t>(scene.meshesData.size());
+	for (const MeshData* meshData : scene.meshesData) {
+		out.Write<uint64_t>(meshData->firstVertex);
+		out.Write<uint64_t>(meshData->firstTriangle);
+		out.Write<uint64_t>(meshData->attribInfo.size());
+		for (auto& attribute : meshData->attribInfo) {
+			out.Write<int32_t>(attribute.first);
+			out.Write(attribute.second);
+		}
+	}
+
+	out.WriteArray(scene.instances);
+
+	// -------- Acceleration structures -----------
+
+	// Bottom levels first, in the order the scene builds them, then the top level
+	out.Write<uint8_t>(accel != nullptr);
+	if (accel) {
+		for (auto& bottomLevel : scene.bottomLevelAccels) {
+			if (!bottomLevel->accel || !bottomLevel->accel->Serialize(out, bottomLevel->geometries)) {
+				return false;
+			}
+		}
+		if (!accel->Serialize(out, scene.geometries)) {
+			return false;
+		}
+	}
+
+	// The old cache may still be mapped, and a mapped file can't be replaced on every platform
+	m_file.Close();
+
+	std::ofstream file(m_cacheFile, std::ios::binary | std::ios::trunc);
+	const std::vector<Byte>& bytes = out.GetBytes();
+	if (!file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size())) {
+		std::cout << "Failed to write scene cache " << m_cacheFile << std::endl;
+		return false;
+	}
+
+	std::cout << "Saved scene cache " << m_cacheFile << std::endl;
+	return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+class AccelStructure;
+class Geometry;
+class Scene;
+
+/**
+ * \brief Binary snapshot of a loaded scene, saved next to its source file. It holds the flattened index and
+ * vertex arrays, the primitives and their instances, the materials with their decoded textures and the built
+ * acceleration structures. Loading it maps the file and copies the arrays out, so the glTF parse and the BVH
+ * builds are skipped entirely.
+ *
+ * A cache is only used when its format version, the size and hash of every source file, and the
+ * acceleration structure's build parameters all match. Otherwise the scene is loaded from its source and
+ * the cache is written again.
+ */
+class SceneCache
+{
+public:
+	/**
+	 * \param accelKey : AccelStructure::GetCacheKey of the structure the scene will use
+	 */
+	SceneCache(
+		const std::string& sceneFile,
+		const std::string& accelKey
+	);
+
+	/**
+	 * \brief Maps the cache and, if it's valid for the scene, fills the scene's arrays, materials and meshes.
+	 * The mapping is kept for LoadAccelStructure.
+	 * \return false if there is no valid cache, the scene is left untouched
+	 */
+	bool
+	Load(
+		Scene* scene
+	);
+
+	/**
+	 * \brief Restores the next acceleration structure, in the order Save wrote them: the bottom levels, then
+	 * the top level. Only valid after Load succeeded, once the geometries are listed in the same order as when
+	 * the cache was saved. Once one fails the following ones fail too.
+	 */
+	bool
+	LoadAccelStructure(
+		AccelStructure* accel,
+		std::vector<std::shared_ptr<Geometry>>& geoms
+	);
+
+	/**
+	 * \brief Writes the cache of a scene just loaded from its source files
+	 * \param accel : the built acceleration structure, nullptr if the scene has none
+	 */
+	bool
+	Save(
+		const Scene& scene,
+		const AccelStructure* accel
+	);
+
+private:
+	std::string m_cacheFile;
+	uint64_t m_accelKeyHash;
+	MappedFile m_file;
+	size_t m_accelOffset; // Where the acceleration structure starts in the mapped cache
+};
@@ -26,11 +26,24 @@ typedef struct VertexAttributeInfoTyp {
 // GEOMETRY
 // ----------
 
+// One glTF primitive. Its vertices and triangles live in the scene's shared arrays, starting at
+// firstVertex and firstTriangle, and its triangle indices are relative to firstVertex. attribInfo
+// describes the source accessors.
 struct MeshData {
-	std::map<EVertexAttribute, std::vector<Byte>> vertexData;
+	size_t firstVertex;
+	size_t firstTriangle;
 	std::map<EVertexAttribute, VertexAttributeInfo> attribInfo;
 };
 
+// One glTF node referencing a mesh that several nodes reference. The mesh's primitives are
+// meshesData[firstMesh, firstMesh + numMeshes), decoded once in object space and shared by all of its
+// instances. Meshes referenced by a single node are baked into world space and have no instance.
+struct MeshInstance {
+	size_t firstMesh;
+	size_t numMeshes;
+	glm::mat4 transform;
+};
+
 // ---------
 // MATERIAL
 // ----------
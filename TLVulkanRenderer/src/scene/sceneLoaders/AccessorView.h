@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstring>
+#include "Typedef.h"
+
+/**
+ * \brief Typed, read-only view of a glTF accessor straight over the buffer bytes, which are usually a
+ * mapped file. Elements are byteStride apart, or tightly packed when the stride is 0 as the spec says, and
+ * are read with memcpy so interleaved and unaligned data are fine. Bounds are checked once when the view
+ * is made, not on every read.
+ */
+template<typename T>
+class AccessorView
+{
+public:
+	AccessorView() :
+		m_data(nullptr),
+		m_byteStride(sizeof(T)),
+		m_count(0)
+	{}
+
+	AccessorView(const Byte* data, size_t byteStride, size_t count) :
+		m_data(data),
+		m_byteStride(byteStride == 0 ? sizeof(T) : byteStride),
+		m_count(count)
+	{}
+
+	T operator[](size_t index) const {
+		T element;
+		memcpy(&element, m_data + index * m_byteStride, sizeof(T));
+		return element;
+	}
+
+	size_t Size() const {
+		return m_count;
+	}
+
+	bool IsValid() const {
+		return m_data != nullptr;
+	}
+
+	/**
+	 * \brief Bytes the view spans, from its first element to the end of its last one
+	 */
+	static size_t GetByteLength(size_t byteStride, size_t count) {
+		if (count == 0) {
+			return 0;
+		}
+		return (count - 1) * (byteStride == 0 ? sizeof(T) : byteStride) + sizeof(T);
+	}
+
+private:
+	const Byte* m_data;
+	size_t m_byteStride;
+	size_t m_count;
+};
@@ -9,8 +9,14 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <memory>
+#include <limits>
 
 #include "gltfLoader.h"
+#include "AccessorView.h"
+#include "MappedFile.h"
+#include "renderer/ThreadPool.h"
 #include "scene/SceneUtil.h"
 #include "scene/Scene.h"
 
@@ -802,21 +808,331 @@ static std::string GetFilePathExtension(const std::string& FileName) {
 	return "";
 }
 
+/**
+ * \brief Bytes of one glTF buffer, either decoded by tinygltf from a data URI or inside a mapped file
+ */
+struct BufferBytes {
+	const Byte* data;
+	size_t size;
+};
+
+/**
+ * \brief Finds the bytes of every buffer. External .bin files are mapped rather than read, each file once
+ * even if several buffers point into it, and the binary glTF body is used in place.
+ * \param binaryBody : body of the mapped .glb, nullptr for ascii glTF
+ * \param mappedFiles : keeps the mappings alive, the views made from the buffers are valid as long as it is
+ * \param sourceFiles : gets the path of every mapped file
+ */
+static bool ResolveBuffers(
+	const tinygltf::Scene& gltf,
+	const std::string& baseDir,
+	const Byte* binaryBody,
+	size_t binaryBodySize,
+	std::map<std::string, std::unique_ptr<MappedFile>>& mappedFiles,
+	std::map<std::string, BufferBytes>& buffers,
+	std::vector<std::string>& sourceFiles
+) {
+	for (auto& buffer : gltf.buffers) {
+		BufferBytes bytes = { nullptr, 0 };
+
+		if (!buffer.second.data.empty()) {
+			bytes.data = buffer.second.data.data();
+			bytes.size = buffer.second.data.size();
+		}
+		else if (buffer.second.uri.compare("data:,") == 0 && binaryBody) {
+			bytes.data = binaryBody;
+			bytes.size = binaryBodySize;
+		}
+		else {
+			auto mappedFile = mappedFiles.find(buffer.second.uri);
+			if (mappedFile == mappedFiles.end()) {
+				std::vector<std::string> paths = { baseDir, "." };
+				std::string filePath = tinygltf::FindFile(paths, buffer.second.uri);
+
+				std::unique_ptr<MappedFile> file(new MappedFile());
+				if (filePath.empty() || !file->Open(filePath)) {
+					printf("Failed to map buffer file %s\n", buffer.second.uri.c_str());
+					return false;
+				}
+				mappedFile = mappedFiles.insert(std::make_pair(buffer.second.uri, std::move(file))).first;
+				sourceFiles.push_back(filePath);
+			}
+			bytes.data = mappedFile->second->GetData();
+			bytes.size = mappedFile->second->GetSize();
+		}
+
+		if (bytes.size < buffer.second.byteLength) {
+			printf("Buffer %s is %zu bytes, expected %zu\n", buffer.first.c_str(), bytes.size, buffer.second.byteLength);
+			return false;
+		}
+		buffers.insert(std::make_pair(buffer.first, bytes));
+	}
+
+	return true;
+}
+
+/**
+ * \brief Makes a view of an accessor holding elements of type T
+ * \return false if the accessor's layout isn't T or it reads past the end of its buffer
+ */
+template<typename T>
+static bool GetAccessorView(
+	const tinygltf::Scene& gltf,
+	const std::map<std::string, BufferBytes>& buffers,
+	const std::string& accessorName,
+	int componentType,
+	int type,
+	AccessorView<T>& view
+) {
+	const tinygltf::Accessor& accessor = gltf.accessors.at(accessorName);
+	if (accessor.componentType != componentType || accessor.type != type) {
+		return false;
+	}
+
+	const tinygltf::BufferView& bufferView = gltf.bufferViews.at(accessor.bufferView);
+	auto buffer = buffers.find(bufferView.buffer);
+	if (buffer == buffers.end()) {
+		return false;
+	}
+
+	size_t byteOffset = bufferView.byteOffset + accessor.byteOffset;
+	if (byteOffset + AccessorView<T>::GetByteLength(accessor.byteStride, accessor.count) > buffer->second.size) {
+		return false;
+	}
+
+	view = AccessorView<T>(buffer->second.data + byteOffset, accessor.byteStride, accessor.count);
+	return true;
+}
+
+/**
+ * \brief Index accessor in whichever of the three index component types glTF allows. Only the view
+ * matching componentType is valid.
+ */
+struct IndexView {
+	int componentType;
+	AccessorView<uint8_t> u8;
+	AccessorView<uint16_t> u16;
+	AccessorView<uint32_t> u32;
+
+	size_t Size() const {
+		return u8.Size() + u16.Size() + u32.Size();
+	}
+};
+
+static bool GetIndexView(
+	const tinygltf::Scene& gltf,
+	const std::map<std::string, BufferBytes>& buffers,
+	const std::string& accessorName,
+	IndexView& view
+) {
+	view = IndexView();
+	view.componentType = gltf.accessors.at(accessorName).componentType;
+	switch (view.componentType) {
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return GetAccessorView(gltf, buffers, accessorName, view.componentType, TINYGLTF_TYPE_SCALAR, view.u8);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		return GetAccessorView(gltf, buffers, accessorName, view.componentType, TINYGLTF_TYPE_SCALAR, view.u16);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		return GetAccessorView(gltf, buffers, accessorName, view.componentType, TINYGLTF_TYPE_SCALAR, view.u32);
+	default:
+		return false;
+	}
+}
+
+/**
+ * \brief Widens a primitive's indices into its slice of the 32 bit scene index array, one triangle per
+ * element with the material in w. Instantiated per component type so the loop reads a fixed type.
+ * \return false if an index is past the primitive's last vertex
+ */
+template<typename T>
+static bool DecodeIndices(
+	const AccessorView<T>& view,
+	size_t numVertices,
+	uint32_t* indices
+) {
+	const size_t numIndices = view.Size() / 3 * 3;
+	T maxIndex = 0;
+	for (size_t i = 0; i < numIndices; ++i) {
+		T index = view[i];
+		maxIndex = std::max(maxIndex, index);
+		indices[i] = index;
+	}
+	return numIndices == 0 || static_cast<size_t>(maxIndex) < numVertices;
+}
+
+static VertexAttributeInfo GetAttributeInfo(const tinygltf::Accessor& accessor) {
+	VertexAttributeInfo attributeInfo = {
+		accessor.byteStride,
+		accessor.count,
+		GLTF_COMPONENT_LENGTH_LOOKUP.at(accessor.type),
+		GLTF_COMPONENT_BYTE_SIZE_LOOKUP.at(accessor.componentType)
+	};
+	return attributeInfo;
+}
+
+static LambertMaterial* LoadMaterial(
+	const tinygltf::Scene& gltf,
+	const std::string& materialName,
+	MaterialPacked& materialPacked
+) {
+	materialPacked = MaterialPacked();
+	materialPacked.transparency = 1.0f;
+	Texture* texture = nullptr;
+
+	if (materialName.empty()) {
+		return new LambertMaterial(materialPacked, texture);
+	}
+
+	const tinygltf::Material& mat = gltf.materials.at(materialName);
+
+	if (mat.values.find("diffuse") != mat.values.end()) {
+		std::string diffuseTexName = mat.values.at("diffuse").string_value;
+		if (gltf.textures.find(diffuseTexName) != gltf.textures.end()) {
+			const tinygltf::Texture& tex = gltf.textures.at(diffuseTexName);
+			if (gltf.images.find(tex.source) != gltf.images.end()) {
+				const tinygltf::Image& image = gltf.images.at(tex.source);
+
+				// Texture bytes
+				texture = new ImageTexture(image.name, image.image, image.width, image.height);
+			}
+		}
+		else {
+			auto diff = mat.values.at("diffuse").number_array;
+			materialPacked.diffuse = glm::vec4(diff.at(0), diff.at(1), diff.at(2), diff.at(3));
+		}
+	}
+
+	if (mat.values.find("ambient") != mat.values.end()) {
+		auto amb = mat.values.at("ambient").number_array;
+		materialPacked.ambient = glm::vec4(amb.at(0), amb.at(1), amb.at(2), amb.at(3));
+	}
+	if (mat.values.find("emission") != mat.values.end()) {
+		auto em = mat.values.at("emission").number_array;
+		materialPacked.emission = glm::vec4(em.at(0), em.at(1), em.at(2), em.at(3));
+
+	}
+	if (mat.values.find("specular") != mat.values.end()) {
+		auto spec = mat.values.at("specular").number_array;
+		materialPacked.specular = glm::vec4(spec.at(0), spec.at(1), spec.at(2), spec.at(3));
+
+	}
+	if (mat.values.find("shininess") != mat.values.end()) {
+		materialPacked.shininess = mat.values.at("shininess").number_array.at(0);
+	}
+
+	if (mat.values.find("transparency") != mat.values.end()) {
+		materialPacked.transparency = mat.values.at("transparency").number_array.at(0);
+	}
+
+	return new LambertMaterial(materialPacked, texture);
+}
+
+const size_t NOT_INSTANCED = std::numeric_limits<size_t>::max();
+
+/**
+ * \brief One primitive to decode, with the place of its output in the scene arrays. Found by the serial
+ * first pass of the loader so the second pass can decode every primitive independently.
+ */
+struct PrimitiveDecodeJob {
+	IndexView indexView;
+	AccessorView<glm::vec3> positionView;
+	AccessorView<glm::vec3> normalView;
+	AccessorView<glm::vec2> uvView; // Invalid if the primitive has no UVs
+	glm::mat4 matrix;
+	glm::mat3 matrixNormal;
+	int materialId;
+	size_t firstVertex;
+	size_t firstTriangle;
+	size_t meshIndex;
+	size_t instancedMesh; // Index in the loader's instanced meshes, NOT_INSTANCED if baked
+	MeshData* meshData;
+	const std::string* meshName;
+	size_t primitiveIndex;
+	bool hasValidIndices;
+};
+
+/**
+ * \brief Decodes and transforms one primitive from the mapped buffers into its slice of the scene arrays,
+ * and builds its triangles. Only touches memory owned by the job, so jobs can run concurrently.
+ */
+static void DecodePrimitive(
+	PrimitiveDecodeJob& job,
+	Scene* scene
+) {
+	const size_t numVertices = job.positionView.Size();
+	const size_t numTriangles = job.indexView.Size() / 3;
+
+	// -------- Indices ----------
+
+	uint32_t* indices = scene->indices.data() + 3 * job.firstTriangle;
+	std::fill_n(scene->triangleMaterials.begin() + job.firstTriangle, numTriangles, job.materialId);
+	switch (job.indexView.componentType) {
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		job.hasValidIndices = DecodeIndices(job.indexView.u8, numVertices, indices);
+		break;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		job.hasValidIndices = DecodeIndices(job.indexView.u16, numVertices, indices);
+		break;
+	default:
+		job.hasValidIndices = DecodeIndices(job.indexView.u32, numVertices, indices);
+		break;
+	}
+	if (!job.hasValidIndices) {
+		// Its slice can't be given back, it is left as degenerate triangles without geometry
+		std::fill_n(indices, 3 * numTriangles, 0);
+		return;
+	}
+
+	// -------- Attributes -----------
+
+	const bool hasUVs = job.uvView.IsValid();
+	for (size_t v = 0; v < numVertices; ++v) {
+		scene->verticePositions[job.firstVertex + v] = glm::vec4(glm::vec3(job.matrix * glm::vec4(job.positionView[v], 1.0f)), 1.0f);
+		scene->verticeNormals[job.firstVertex + v] = glm::vec4(glm::normalize(job.matrixNormal * job.normalView[v]), 0.0f);
+		if (hasUVs) {
+			scene->verticeUVs[job.firstVertex + v] = job.uvView[v];
+		}
+	}
+
+	// -------- Triangles -----------
+
+	scene->BuildMeshTriangles(*job.meshData, scene->meshes[job.meshIndex]);
+}
+
 bool gltfLoader::Load(std::string fileName, Scene* scene)
 {
 	tinygltf::Scene tinygltfScene;
 	tinygltf::TinyGLTFLoader loader;
 	std::string err;
 	std::string ext = GetFilePathExtension(fileName);
+	std::string baseDir = tinygltf::GetBaseDir(fileName);
+
+	// Buffer payloads are mapped below instead of being copied by tinygltf
+	loader.SetLoadBufferData(false);
+
+	MappedFile gltfFile;
+	if (!gltfFile.Open(fileName) || gltfFile.GetSize() == 0) {
+		printf("Failed to open %s\n", fileName.c_str());
+		return false;
+	}
 
 	bool ret = false;
+	const Byte* binaryBody = nullptr;
+	size_t binaryBodySize = 0;
 	if (ext.compare("glb") == 0) {
 		// binary glTF.
-		ret = loader.LoadBinaryFromFile(&tinygltfScene, &err, fileName.c_str());
+		ret = loader.LoadBinaryFromMemory(&tinygltfScene, &err, gltfFile.GetData(), static_cast<unsigned int>(gltfFile.GetSize()), baseDir);
+		if (ret) {
+			// Header is magic, version, length, scene length and scene format, the body follows the scene
+			uint32_t sceneLength;
+			memcpy(&sceneLength, gltfFile.GetData() + 12, sizeof(sceneLength));
+			binaryBody = gltfFile.GetData() + 20 + sceneLength;
+			binaryBodySize = gltfFile.GetSize() - 20 - sceneLength;
+		}
 	}
 	else {
 		// ascii glTF.
-		ret = loader.LoadASCIIFromFile(&tinygltfScene, &err, fileName.c_str());
+		ret = loader.LoadASCIIFromString(&tinygltfScene, &err, reinterpret_cast<const char*>(gltfFile.GetData()), static_cast<unsigned int>(gltfFile.GetSize()), baseDir);
 	}
 
 	// Can't find file
@@ -829,6 +1145,24 @@ bool gltfLoader::Load(std::string fileName, Scene* scene)
 		return false;
 	}
 
+	std::map<std::string, std::unique_ptr<MappedFile>> mappedFiles;
+	std::map<std::string, BufferBytes> buffers;
+	scene->sourceFiles.push_back(fileName);
+	if (!ResolveBuffers(tinygltfScene, baseDir, binaryBody, binaryBodySize, mappedFiles, buffers, scene->sourceFiles)) {
+		return false;
+	}
+
+	// External images are sources of the scene cache too
+	for (auto& image : tinygltfScene.images) {
+		if (image.second.bufferView.empty() && !image.second.uri.empty() && image.second.uri.compare(0, 5, "data:") != 0) {
+			std::vector<std::string> paths = { baseDir, "." };
+			std::string filePath = tinygltf::FindFile(paths, image.second.uri);
+			if (!filePath.empty()) {
+				scene->sourceFiles.push_back(filePath);
+			}
+		}
+	}
+
 	// ----------- Transformation matrix --------- 
 	std::map<std::string, glm::mat4> nodeString2Matrix;
 	auto rootNodeNamesList = tinygltfScene.scenes.at(tinygltfScene.defaultScene);
@@ -836,229 +1170,177 @@ bool gltfLoader::Load(std::string fileName, Scene* scene)
 		TraverseGLTFNode(nodeString2Matrix, tinygltfScene, sceneNode, glm::mat4(1.0f));
 	}
 
-	// -------- For each mesh -----------
+	// Primitives sharing a glTF material share one scene material
+	std::map<std::string, int> materialIds;
+
+	// Meshes referenced by several nodes are decoded once in object space and instanced, the others are
+	// baked into world space
+	std::map<std::string, int> meshReferences;
+	for (auto& nodeString : nodeString2Matrix) {
+		for (auto& meshName : tinygltfScene.nodes.at(nodeString.first).meshes) {
+			meshReferences[meshName]++;
+		}
+	}
+	std::map<std::string, size_t> instancedMeshIds;
+	std::vector<std::pair<size_t, glm::mat4>> instanceTransforms;
+
+	// -------- First pass: validate every primitive and give it its place in the scene arrays -----------
+
+	std::vector<PrimitiveDecodeJob> jobs;
+	size_t numVertices = scene->verticePositions.size();
+	size_t numTriangles = scene->triangleMaterials.size();
+	bool hasUVs = false;
 
-	unsigned int idxOffset = 0;
-	unsigned vertOffset = 0;
 	for (auto& nodeString : nodeString2Matrix) {
 
 		const tinygltf::Node& node = tinygltfScene.nodes.at(nodeString.first);
-		const glm::mat4& matrix = nodeString.second;
-		const glm::mat3& matrixNormal = glm::transpose(glm::inverse(glm::mat3(matrix)));
 
-		int materialId = 0;
 		for (auto& meshName : node.meshes) {
+			glm::mat4 matrix = nodeString.second;
+			size_t instancedMesh = NOT_INSTANCED;
+			if (meshReferences.at(meshName) > 1) {
+				auto instancedMeshId = instancedMeshIds.find(meshName);
+				bool isDecoded = instancedMeshId != instancedMeshIds.end();
+				if (!isDecoded) {
+					instancedMeshId = instancedMeshIds.insert(std::make_pair(meshName, instancedMeshIds.size())).first;
+				}
+				instanceTransforms.push_back(std::make_pair(instancedMeshId->second, matrix));
+				if (isDecoded) {
+					continue;
+				}
+				instancedMesh = instancedMeshId->second;
+				matrix = glm::mat4(1.0f);
+			}
+			const glm::mat3 matrixNormal = glm::transpose(glm::inverse(glm::mat3(matrix)));
+
 			auto& mesh = tinygltfScene.meshes.at(meshName);
 			for (size_t i = 0; i < mesh.primitives.size(); i++) {
-				auto primitive = mesh.primitives[i];
-				if (primitive.indices.empty()) {
-					return true;
+				const tinygltf::Primitive& primitive = mesh.primitives[i];
+				auto position = primitive.attributes.find("POSITION");
+				auto normal = primitive.attributes.find("NORMAL");
+				auto texcoord = primitive.attributes.find("TEXCOORD_0");
+
+				// -------- Views -----------
+
+				// Only the layouts below are read, other primitives are skipped rather than misread
+				PrimitiveDecodeJob job;
+				if (primitive.indices.empty() ||
+					!GetIndexView(tinygltfScene, buffers, primitive.indices, job.indexView)) {
+					printf("Skipping primitive %zu of mesh %s: needs unsigned byte, short or int indices\n", i, meshName.c_str());
+					continue;
+				}
+				if (position == primitive.attributes.end() || normal == primitive.attributes.end() ||
+					!GetAccessorView(tinygltfScene, buffers, position->second, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, job.positionView) ||
+					!GetAccessorView(tinygltfScene, buffers, normal->second, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, job.normalView) ||
+					job.normalView.Size() != job.positionView.Size()) {
+					printf("Skipping primitive %zu of mesh %s: needs float positions and normals\n", i, meshName.c_str());
+					continue;
+				}
+				if (texcoord == primitive.attributes.end() ||
+					!GetAccessorView(tinygltfScene, buffers, texcoord->second, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC2, job.uvView) ||
+					job.uvView.Size() != job.positionView.Size()) {
+					job.uvView = AccessorView<glm::vec2>();
 				}
 
-				MeshData* geom = new MeshData();
+				// ----------Materials-------------
 
-				// -------- Indices ----------
-				{
-					// Get accessor info
-					auto indexAccessor = tinygltfScene.accessors.at(primitive.indices);
-					auto indexBufferView = tinygltfScene.bufferViews.at(indexAccessor.bufferView);
-					auto indexBuffer = tinygltfScene.buffers.at(indexBufferView.buffer);
-
-					int componentLength = GLTF_COMPONENT_LENGTH_LOOKUP.at(indexAccessor.type);
-					int componentTypeByteSize = GLTF_COMPONENT_BYTE_SIZE_LOOKUP.at(indexAccessor.componentType);
-
-					// Extra index data
-					unsigned int bufferOffset = indexBufferView.byteOffset + indexAccessor.byteOffset;
-					unsigned int bufferLength = indexAccessor.count * componentLength * componentTypeByteSize;
-					auto first = indexBuffer.data.begin() + bufferOffset;
-					auto last = indexBuffer.data.begin() + bufferOffset + bufferLength;
-					std::vector<Byte> data = std::vector<Byte>(first, last);
-
-					VertexAttributeInfo attributeInfo = {
-						indexAccessor.byteStride,
-						indexAccessor.count,
-						componentLength,
-						componentTypeByteSize
-					};
-					geom->attribInfo.insert(std::make_pair(EVertexAttribute::INDEX, attributeInfo));
-					geom->vertexData.insert(std::make_pair(EVertexAttribute::INDEX, data));
-
-					int indicesCount = indexAccessor.count;
-					uint16_t* in = reinterpret_cast<uint16_t*>(data.data());
-					for (auto iCount = 0; iCount < indicesCount; iCount += 3) {
-						scene->indices.push_back(glm::ivec4(in[iCount], in[iCount + 1], in[iCount + 2], materialId));
-					}
+				auto materialId = materialIds.find(primitive.material);
+				if (materialId == materialIds.end()) {
+					MaterialPacked materialPacked;
+					scene->materials.push_back(LoadMaterial(tinygltfScene, primitive.material, materialPacked));
+					scene->materialPackeds.push_back(materialPacked);
+					materialId = materialIds.insert(std::make_pair(primitive.material, static_cast<int>(scene->materials.size() - 1))).first;
 				}
 
-				// -------- Attributes -----------
-
-				for (auto& attribute : primitive.attributes) {
-
-					// Get accessor info
-					auto& accessor = tinygltfScene.accessors.at(attribute.second);
-					auto& bufferView = tinygltfScene.bufferViews.at(accessor.bufferView);
-					auto& buffer = tinygltfScene.buffers.at(bufferView.buffer);
-					int componentLength = GLTF_COMPONENT_LENGTH_LOOKUP.at(accessor.type);
-					int componentTypeByteSize = GLTF_COMPONENT_BYTE_SIZE_LOOKUP.at(accessor.componentType);
-
-					// Extra vertex data from buffer
-					int bufferOffset = bufferView.byteOffset + accessor.byteOffset;
-					int bufferLength = accessor.count * componentLength * componentTypeByteSize;
-					auto first = buffer.data.begin() + bufferOffset;
-					auto last = buffer.data.begin() + bufferOffset + bufferLength;
-					std::vector<Byte> data = std::vector<Byte>(first, last);
-
-					EVertexAttribute attributeType;
-
-					// -------- Position attribute -----------
-
-					if (attribute.first.compare("POSITION") == 0) {
-						attributeType = EVertexAttribute::POSITION;
-						int positionCount = accessor.count;
-						glm::vec3* positions = reinterpret_cast<glm::vec3*>(data.data());
-						for (auto p = 0; p < positionCount; ++p) {
-							positions[p] = glm::vec3(matrix * glm::vec4(positions[p], 1.0f));
-							scene->verticePositions.push_back(glm::vec4(positions[p], 1.0f));
-						}
-					}
-
-					// -------- Normal attribute -----------
-
-					else if (attribute.first.compare("NORMAL") == 0) {
-						attributeType = EVertexAttribute::NORMAL;
-						int normalCount = accessor.count;
-						glm::vec3* normals = reinterpret_cast<glm::vec3*>(data.data());
-						for (auto p = 0; p < normalCount; ++p) {
-							normals[p] = glm::normalize(matrixNormal * glm::vec4(normals[p], 1.0f));
-							scene->verticeNormals.push_back(glm::vec4(normals[p], 0.0f));
-						}
-					}
-
-					// -------- Texcoord attribute -----------
-
-					else if (attribute.first.compare("TEXCOORD_0") == 0) {
-						attributeType = EVertexAttribute::TEXCOORD;
-						int uvCount = accessor.count;
-						glm::vec2* uvs = reinterpret_cast<glm::vec2*>(data.data());
-						for (auto p = 0; p < uvCount; ++p)
-						{
-							scene->verticeUVs.push_back(uvs[p]);
-						}
-					}
-
-					VertexAttributeInfo attributeInfo = {
-						accessor.byteStride,
-						accessor.count,
-						componentLength,
-						componentTypeByteSize
-					};
-					geom->attribInfo.insert(std::make_pair(attributeType, attributeInfo));
-					geom->vertexData.insert(std::make_pair(attributeType, data));
-
-					// ----------Materials-------------
-
-					//TextureData* dev_diffuseTex = NULL;
-					MaterialPacked materialPacked;
-					Texture* texture = nullptr;
-					if (!primitive.material.empty()) {
-						const tinygltf::Material& mat = tinygltfScene.materials.at(primitive.material);
-
-						if (mat.values.find("diffuse") != mat.values.end()) {
-							std::string diffuseTexName = mat.values.at("diffuse").string_value;
-							if (tinygltfScene.textures.find(diffuseTexName) != tinygltfScene.textures.end()) {
-								const tinygltf::Texture& tex = tinygltfScene.textures.at(diffuseTexName);
-								if (tinygltfScene.images.find(tex.source) != tinygltfScene.images.end()) {
-									const tinygltf::Image& image = tinygltfScene.images.at(tex.source);
-
-									// Texture bytes
-									texture = new ImageTexture(image.name, image.image, image.width, image.height);
-								}
-							}
-							else {
-								auto diff = mat.values.at("diffuse").number_array;
-								materialPacked.diffuse = glm::vec4(diff.at(0), diff.at(1), diff.at(2), diff.at(3));
-							}
-						}
-
-						if (mat.values.find("ambient") != mat.values.end()) {
-							auto amb = mat.values.at("ambient").number_array;
-							materialPacked.ambient = glm::vec4(amb.at(0), amb.at(1), amb.at(2), amb.at(3));
-						}
-						if (mat.values.find("emission") != mat.values.end()) {
-							auto em = mat.values.at("emission").number_array;
-							materialPacked.emission = glm::vec4(em.at(0), em.at(1), em.at(2), em.at(3));
-
-						}
-						if (mat.values.find("specular") != mat.values.end()) {
-							auto spec = mat.values.at("specular").number_array;
-							materialPacked.specular = glm::vec4(spec.at(0), spec.at(1), spec.at(2), spec.at(3));
-
-						}
-						if (mat.values.find("shininess") != mat.values.end()) {
-							materialPacked.shininess = mat.values.at("shininess").number_array.at(0);
-						}
-
-						if (mat.values.find("transparency") != mat.values.end()) {
-							materialPacked.transparency = mat.values.at("transparency").number_array.at(0);
-						}
-						else {
-							materialPacked.transparency = 1.0f;
-						}
-
-						scene->materials.push_back(new LambertMaterial(materialPacked, texture));
-
-						scene->materialPackeds.push_back(materialPacked);
-						++materialId;
-
-					} // --End of materials
-				} // -- End of attributes
-
-				scene->meshesData.push_back(geom);
-
-				Mesh newMesh;
-				for (unsigned int j = idxOffset; j < scene->indices.size(); j++)
-				{
-					ivec4 idx = scene->indices[j];
-					
-
-					if (scene->verticeUVs.size() == 0) {
-						// No UVs
-						newMesh.triangles.push_back(
-							Triangle(
-								scene->verticePositions[idx.x + vertOffset],
-								scene->verticePositions[idx.y + vertOffset],
-								scene->verticePositions[idx.z + vertOffset],
-								scene->verticeNormals[idx.x + vertOffset],
-								scene->verticeNormals[idx.y + vertOffset],
-								scene->verticeNormals[idx.z + vertOffset],
-								scene->materials[materialId - 1]
-							)
-						);
-					}
-					else
-					{
-						newMesh.triangles.push_back(
-							Triangle(
-								scene->verticePositions[idx.x + vertOffset],
-								scene->verticePositions[idx.y + vertOffset],
-								scene->verticePositions[idx.z + vertOffset],
-								scene->verticeNormals[idx.x + vertOffset],
-								scene->verticeNormals[idx.y + vertOffset],
-								scene->verticeNormals[idx.z + vertOffset],
-								scene->verticeUVs[idx.x + vertOffset],
-								scene->verticeUVs[idx.y + vertOffset],
-								scene->verticeUVs[idx.z + vertOffset],
-								scene->materials[materialId - 1]
-							)
-						);
-					}
+				job.matrix = matrix;
+				job.matrixNormal = matrixNormal;
+				job.materialId = materialId->second;
+				job.firstVertex = numVertices;
+				job.firstTriangle = numTriangles;
+				job.meshIndex = scene->meshes.size() + jobs.size();
+				job.instancedMesh = instancedMesh;
+				job.meshName = &meshName;
+				job.primitiveIndex = i;
+				numVertices += job.positionView.Size();
+				numTriangles += job.indexView.Size() / 3;
+				hasUVs |= job.uvView.IsValid();
+
+				MeshData* geom = new MeshData();
+				geom->firstVertex = job.firstVertex;
+				geom->firstTriangle = job.firstTriangle;
+				geom->attribInfo.insert(std::make_pair(EVertexAttribute::INDEX, GetAttributeInfo(tinygltfScene.accessors.at(primitive.indices))));
+				geom->attribInfo.insert(std::make_pair(EVertexAttribute::POSITION, GetAttributeInfo(tinygltfScene.accessors.at(position->second))));
+				geom->attribInfo.insert(std::make_pair(EVertexAttribute::NORMAL, GetAttributeInfo(tinygltfScene.accessors.at(normal->second))));
+				if (job.uvView.IsValid()) {
+					geom->attribInfo.insert(std::make_pair(EVertexAttribute::TEXCOORD, GetAttributeInfo(tinygltfScene.accessors.at(texcoord->second))));
 				}
-				scene->meshes.push_back(newMesh);
-				idxOffset = scene->indices.size();
-				vertOffset = scene->verticePositions.size();
+				job.meshData = geom;
 
+				jobs.push_back(job);
 			} // -- End of mesh primitives
 		} // -- End of meshes
 	}
+
+	// Every array is allocated once for the whole scene
+	scene->indices.resize(3 * numTriangles);
+	scene->triangleMaterials.resize(numTriangles);
+	scene->verticePositions.resize(numVertices);
+	scene->verticeNormals.resize(numVertices);
+	if (hasUVs) {
+		// Primitives without UVs are padded so the arrays stay aligned
+		scene->verticeUVs.resize(numVertices);
+	}
+	scene->meshes.resize(scene->meshes.size() + jobs.size());
+
+	// -------- Second pass: decode the primitives in parallel, largest first to balance the threads -----------
+
+	std::vector<uint32_t> jobOrder(jobs.size());
+	for (uint32_t j = 0; j < jobOrder.size(); ++j) {
+		jobOrder[j] = j;
+	}
+	std::stable_sort(jobOrder.begin(), jobOrder.end(), [&jobs](uint32_t a, uint32_t b) {
+		return jobs[a].positionView.Size() + jobs[a].indexView.Size() > jobs[b].positionView.Size() + jobs[b].indexView.Size();
+	});
+
+	{
+		ThreadPool threadPool(static_cast<uint32_t>(std::min<size_t>(jobs.size(), std::thread::hardware_concurrency())));
+		threadPool.ParallelFor(static_cast<uint32_t>(jobs.size()), [&](uint32_t index, uint32_t threadId) {
+			DecodePrimitive(jobs[jobOrder[index]], scene);
+		});
+	}
+
+	// Skipped primitives are dropped so meshes and meshesData stay aligned
+	size_t meshIndex = jobs.empty() ? scene->meshes.size() : jobs.front().meshIndex;
+	std::vector<MeshInstance> instancedMeshes(instancedMeshIds.size(), MeshInstance{ 0, 0, glm::mat4(1.0f) });
+	for (PrimitiveDecodeJob& job : jobs) {
+		if (job.hasValidIndices) {
+			if (job.meshIndex != meshIndex) {
+				scene->meshes[meshIndex] = scene->meshes[job.meshIndex];
+			}
+			if (job.instancedMesh != NOT_INSTANCED) {
+				MeshInstance& instancedMesh = instancedMeshes[job.instancedMesh];
+				if (instancedMesh.numMeshes == 0) {
+					instancedMesh.firstMesh = meshIndex;
+				}
+				instancedMesh.numMeshes++;
+			}
+			scene->meshesData.push_back(job.meshData);
+			meshIndex++;
+		}
+		else {
+			printf("Skipping primitive %zu of mesh %s: indices out of range\n", job.primitiveIndex, job.meshName->c_str());
+			delete job.meshData;
+		}
+	}
+	scene->meshes.resize(meshIndex);
+
+	for (auto& instanceTransform : instanceTransforms) {
+		MeshInstance instance = instancedMeshes[instanceTransform.first];
+		if (instance.numMeshes > 0) {
+			instance.transform = instanceTransform.second;
+			scene->instances.push_back(instance);
+		}
+	}
+
 	return ret;
 }
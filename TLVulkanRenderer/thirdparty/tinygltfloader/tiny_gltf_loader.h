@@ -350,6 +350,7 @@ namespace tinygltf
 		int component;
 		int pad0;
 		std::vector<unsigned char> image;
+		std::string uri;
 
 		std::string bufferView;  // KHR_binary_glTF extenstion.
 		std::string mimeType;    // KHR_binary_glTF extenstion.
@@ -466,6 +467,8 @@ namespace tinygltf
 	{
 		std::string name;
 		std::vector<unsigned char> data;
+		std::string uri;
+		size_t byteLength;
 		Value extras;
 	} Buffer;
 
@@ -565,11 +568,19 @@ namespace tinygltf
 	class TinyGLTFLoader
 	{
 	public:
-		TinyGLTFLoader() : bin_data_(NULL), bin_size_(0), is_binary_(false) {
-			pad[0] = pad[1] = pad[2] = pad[3] = pad[4] = pad[5] = pad[6] = 0;
+		TinyGLTFLoader() : bin_data_(NULL), bin_size_(0), is_binary_(false), load_buffer_data_(true) {
+			pad[0] = pad[1] = pad[2] = pad[3] = pad[4] = pad[5] = 0;
 		}
 		~TinyGLTFLoader() {}
 
+		/// When false, buffers stored in external files or in the binary glTF
+		/// body are not read into `Buffer::data'. Only their `uri' and
+		/// `byteLength' are set, so the caller can map the payload itself.
+		/// Data URIs are still decoded.
+		void SetLoadBufferData(bool load_buffer_data) {
+			load_buffer_data_ = load_buffer_data;
+		}
+
 		/// Loads glTF ASCII asset from a file.
 		/// Returns false and set error string to `err` if there's an error.
 		bool LoadASCIIFromFile(Scene *scene, std::string *err,
@@ -610,7 +621,8 @@ namespace tinygltf
 		const unsigned char *bin_data_;
 		size_t bin_size_;
 		bool is_binary_;
-		char pad[7];
+		bool load_buffer_data_;
+		char pad[6];
 	};
 
 }  // namespace tinygltf
@@ -1549,6 +1561,7 @@ namespace tinygltf
 		}
 
 		ParseStringProperty(&image->name, err, o, "name", false);
+		image->uri = uri;
 
 		std::vector<unsigned char> img;
 
@@ -1696,7 +1709,8 @@ namespace tinygltf
 		const picojson::object &o, const std::string &basedir,
 		bool is_binary = false,
 		const unsigned char *bin_data = NULL,
-		size_t bin_size = 0) {
+		size_t bin_size = 0,
+		bool load_data = true) {
 		double byteLength;
 		if (!ParseNumberProperty(&byteLength, err, o, "byteLength", true))
 		{
@@ -1709,6 +1723,9 @@ namespace tinygltf
 			return false;
 		}
 
+		buffer->uri = uri;
+		buffer->byteLength = static_cast<size_t>(byteLength);
+
 		picojson::object::const_iterator type = o.find("type");
 		if (type != o.end())
 		{
@@ -1723,7 +1740,11 @@ namespace tinygltf
 		}
 
 		size_t bytes = static_cast<size_t>(byteLength);
-		if (is_binary)
+		if (!load_data && !IsDataURI(uri))
+		{
+			// Left to the caller
+		}
+		else if (is_binary)
 		{
 			// Still binary glTF accepts external dataURI. First try external resources.
 			bool loaded = false;
@@ -2612,7 +2633,7 @@ namespace tinygltf
 			{
 				Buffer buffer;
 				if (!ParseBuffer(&buffer, err, (it->second).get<picojson::object>(),
-					base_dir, is_binary_, bin_data_, bin_size_))
+					base_dir, is_binary_, bin_data_, bin_size_, load_buffer_data_))
 				{
 					return false;
 				}
@@ -2791,8 +2812,27 @@ namespace tinygltf
 					const BufferView &bufferView = scene->bufferViews[image.bufferView];
 					const Buffer &buffer = scene->buffers[bufferView.buffer];
 
+					// Buffers that weren't loaded are still reachable in the binary body
+					const unsigned char *bufferData = NULL;
+					if (!buffer.data.empty())
+					{
+						bufferData = &buffer.data[0];
+					}
+					else if (is_binary_ && buffer.uri.compare("data:,") == 0)
+					{
+						bufferData = bin_data_;
+					}
+					else
+					{
+						if (err)
+						{
+							(*err) += "Image buffer data not loaded.\n";
+						}
+						return false;
+					}
+
 					bool ret = LoadImageData(&image, err, image.width, image.height,
-						&buffer.data[bufferView.byteOffset],
+						bufferData + bufferView.byteOffset,
 						static_cast<int>(bufferView.byteLength));
 					if (!ret)
 					{